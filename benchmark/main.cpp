@@ -0,0 +1,192 @@
+/*
+* Copyright (c) 2006-2009 Erin Catto http://www.gphysics.com
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee,
+* provided that the above copyright notice appear in all copies.
+* Erin Catto makes no representations about the suitability
+* of this software for any purpose.
+* It is provided "as is" without express or implied warranty.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "box2d-lite/World.h"
+#include "box2d-lite/Body.h"
+#include "box2d-lite/Joint.h"
+#include "box2d-lite/ThreadPool.h"
+
+namespace
+{
+	const float timeStep = 1.0f / 60.0f;
+	const int iterations = 10;
+	const int stepCount = 300;
+	const Vec2 gravity(0.0f, -10.0f);
+
+	std::vector<Body> bodies;
+	std::vector<Joint> joints;
+}
+
+static Body* AddBody(World& world, const Vec2& width, float mass, const Vec2& position)
+{
+	bodies.push_back(Body());
+	Body* b = &bodies.back();
+	b->Set(width, mass);
+	b->position = position;
+	world.Add(b);
+	return b;
+}
+
+static Body* AddGround(World& world)
+{
+	return AddBody(world, Vec2(200.0f, 20.0f), FLT_MAX, Vec2(0.0f, -10.0f));
+}
+
+// Many small pyramids side by side, one island each.
+static void Pyramids(World& world)
+{
+	AddGround(world);
+
+	const int pyramidCount = 8;
+	const int baseCount = 10;
+
+	for (int p = 0; p < pyramidCount; ++p)
+	{
+		Vec2 x(-90.0f + 22.0f * p, 0.5f);
+
+		for (int i = 0; i < baseCount; ++i)
+		{
+			Vec2 y = x;
+
+			for (int j = i; j < baseCount; ++j)
+			{
+				AddBody(world, Vec2(1.0f, 1.0f), 10.0f, y);
+				y += Vec2(1.125f, 0.0f);
+			}
+
+			x += Vec2(0.5625f, 1.0f);
+		}
+	}
+}
+
+// Hanging chains, one island each.
+static void Chains(World& world)
+{
+	Body* ground = AddGround(world);
+
+	const int chainCount = 16;
+	const int linkCount = 20;
+
+	for (int c = 0; c < chainCount; ++c)
+	{
+		float x0 = -90.0f + 11.0f * c;
+		Body* previous = ground;
+
+		for (int i = 0; i < linkCount; ++i)
+		{
+			Body* b = AddBody(world, Vec2(0.75f, 0.25f), 10.0f, Vec2(x0 + 0.5f + i, 30.0f));
+
+			joints.push_back(Joint());
+			Joint* j = &joints.back();
+			j->Set(previous, b, Vec2(x0 + float(i), 30.0f));
+			world.Add(j);
+
+			previous = b;
+		}
+	}
+}
+
+struct Scene
+{
+	const char* name;
+	void (*create)(World& world);
+};
+
+static const Scene scenes[] =
+{
+	{"pyramids", Pyramids},
+	{"chains", Chains},
+};
+
+static unsigned int Checksum(const World& world)
+{
+	// FNV-1a over the raw bits, so any difference shows up.
+	unsigned int hash = 2166136261u;
+	for (int i = 0; i < (int)world.bodies.size(); ++i)
+	{
+		const Body* b = world.bodies[i];
+		float values[3] = {b->position.x, b->position.y, b->rotation};
+		unsigned char bytes[sizeof(values)];
+		memcpy(bytes, values, sizeof(values));
+		for (int k = 0; k < (int)sizeof(bytes); ++k)
+		{
+			hash ^= bytes[k];
+			hash *= 16777619u;
+		}
+	}
+	return hash;
+}
+
+static double Run(const Scene& scene, ThreadPool* pool, unsigned int* checksum)
+{
+	// The vectors must not reallocate while the world points into them.
+	bodies.clear();
+	joints.clear();
+	bodies.reserve(4096);
+	joints.reserve(4096);
+
+	World world(gravity, iterations);
+	world.threadPool = pool;
+	scene.create(world);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int i = 0; i < stepCount; ++i)
+		world.Step(timeStep);
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+	*checksum = Checksum(world);
+	return std::chrono::duration<double, std::milli>(end - start).count() / stepCount;
+}
+
+int main(int argc, char** argv)
+{
+	int maxThreads = (int)std::thread::hardware_concurrency();
+	if (argc > 1)
+		maxThreads = atoi(argv[1]);
+	if (maxThreads < 1)
+		maxThreads = 1;
+
+	printf("%d steps, %d iterations, 1 to %d threads\n", stepCount, iterations, maxThreads);
+
+	for (int s = 0; s < (int)(sizeof(scenes) / sizeof(scenes[0])); ++s)
+	{
+		const Scene& scene = scenes[s];
+		printf("\n%-10s %8s %10s %8s %10s\n", scene.name, "threads", "ms/step", "speedup", "checksum");
+
+		double baseTime = 0.0;
+		unsigned int baseChecksum = 0;
+
+		for (int t = 1; t <= maxThreads; ++t)
+		{
+			ThreadPool pool(t);
+			unsigned int checksum;
+			double time = Run(scene, &pool, &checksum);
+
+			if (t == 1)
+			{
+				baseTime = time;
+				baseChecksum = checksum;
+			}
+
+			printf("%-10s %8d %10.3f %8.2f   %08x%s\n", "", t, time, baseTime / time, checksum,
+				checksum == baseChecksum ? "" : " MISMATCH");
+		}
+	}
+
+	return 0;
+}
@@ -15,6 +15,7 @@
 #include "MathUtils.h"
 
 struct Body;
+struct World;
 
 union FeaturePair
 {
@@ -41,25 +42,56 @@ struct Contact
 	float Pnb;	// accumulated normal impulse for position bias
 	float massNormal, massTangent;
 	float bias;
+	float positionBias;	// target normal pseudo-velocity for split impulses
 	FeaturePair feature;
 };
 
 struct ArbiterKey
 {
-	ArbiterKey(Body* b1, Body* b2)
+	// A body meets each segment of a chain and each box of a compound
+	// through its own arbiter, named by the children of both bodies. The
+	// child of any other shape is 0.
+	ArbiterKey(Body* b1, Body* b2, int c1, int c2)
 	{
 		if (b1 < b2)
 		{
 			body1 = b1; body2 = b2;
+			child1 = c1; child2 = c2;
 		}
 		else
 		{
 			body1 = b2; body2 = b1;
+			child1 = c2; child2 = c1;
 		}
 	}
 
 	Body* body1;
 	Body* body2;
+	int child1, child2;
+};
+
+// A pair the broadphase found, and how far apart its contacts may be.
+struct CandidatePair
+{
+	ArbiterKey key;
+	float margin;
+};
+
+// A candidate pair for the batched narrowphase. The bodies are ordered as
+// in Arbiter and CollidePairs fills in the contacts.
+struct CollidePair
+{
+	Body* body1;
+	Body* body2;
+	Contact contacts[2];
+	int numContacts;
+
+	// The segment of a chain or the box of a compound, for each body.
+	int child1, child2;
+
+	// Contacts are kept up to this far apart (m). See
+	// World::Settings::speculativeContacts.
+	float margin;
 };
 
 struct Arbiter
@@ -67,11 +99,45 @@ struct Arbiter
 	enum {MAX_POINTS = 2};
 
 	Arbiter(Body* b1, Body* b2);
+	Arbiter(const CollidePair& pair);
+
+	// The solver kernels are specialized on the World switches they depend
+	// on, so their loops don't test them. See Island::SelectSolve.
+	template <bool warm> void Update(const Contact* contacts, int numContacts);
+
+	template <bool accumulate, bool correct> void PreStep(const World& world, float inv_dt);
+	void PrepareBlockSolve();
 
-	void Update(Contact* contacts, int numContacts);
+	// Rebuilds the effective masses after the body masses were changed.
+	void UpdateMass();
 
-	void PreStep(float inv_dt);
-	void ApplyImpulse();
+	// These return the largest change in relative velocity caused by the
+	// impulses applied, which measures how far the solver is from converged.
+	template <bool accumulate> float ApplyImpulse();
+	template <bool accumulate> float ApplyBiasImpulse();
+
+	// Position solver. Moves the bodies to remove overlap beyond the
+	// allowed penetration and returns the largest such overlap it found.
+	float SolvePosition();
+
+	// Normal impulses only, with the current body masses, for shock
+	// propagation. Leaves the accumulated impulses as they were.
+	float ApplyShockImpulse();
+
+	// Jacobi solver. Reads the body velocities without changing them and
+	// writes the relaxed velocity change of each body instead.
+	template <bool accumulate> float ApplyJacobiImpulse(float relaxation, VelocityDelta* delta1, VelocityDelta* delta2);
+
+	// Solves the contacts against the given velocities and updates them.
+	template <bool accumulate> float SolveVelocity(Vec2& v1, float& w1, Vec2& v2, float& w2);
+	float SolveBlockVelocity(Vec2& v1, float& w1, Vec2& v2, float& w2);
+	float SolveBlockNormal(Vec2& v1, float& w1, Vec2& v2, float& w2);
+
+	// Soft step solver. The anchors are fixed for the step and the
+	// separation is tracked through the bodies' motion.
+	void PrepareSoft();
+	void WarmStart();
+	void SolveSoft(const Softness& softness, float inv_h, bool useBias);
 
 	Contact contacts[MAX_POINTS];
 	int numContacts;
@@ -81,6 +147,16 @@ struct Arbiter
 
 	// Combined friction
 	float friction;
+
+	// Normal mass matrix of both points and its inverse, for the block solver.
+	Mat22 K, normalMass;
+	bool blockSolve;
+
+	// Set when the narrowphase finds contacts for the pair again.
+	// World::UpdateArbiters removes the arbiters it didn't set this on,
+	// which includes the chain segments and compound boxes that are no
+	// longer near the other body and so were not paired at all.
+	bool paired;
 };
 
 // This is used by std::set
@@ -92,9 +168,26 @@ inline bool operator < (const ArbiterKey& a1, const ArbiterKey& a2)
 	if (a1.body1 == a2.body1 && a1.body2 < a2.body2)
 		return true;
 
+	if (a1.body1 != a2.body1 || a1.body2 != a2.body2)
+		return false;
+
+	if (a1.child1 < a2.child1)
+		return true;
+
+	if (a1.child1 == a2.child1 && a1.child2 < a2.child2)
+		return true;
+
 	return false;
 }
 
-int Collide(Contact* contacts, Body* body1, Body* body2);
+// Contacts with a separation of at most margin, so a positive margin also
+// finds the points the bodies may reach before they touch. The children
+// are the segments of chains and the boxes of compounds.
+int Collide(Contact* contacts, Body* body1, Body* body2, int child1, int child2, float margin);
+
+// Same as Collide on every pair. The face separation tests of the box
+// pairs run on several pairs at once and only the boxes that overlap are
+// clipped.
+void CollidePairs(CollidePair* pairs, int count);
 
 #endif
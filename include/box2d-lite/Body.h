@@ -12,32 +12,248 @@
 #ifndef BODY_H
 #define BODY_H
 
+#include <vector>
 #include "MathUtils.h"
 
+// A convex polygon in the frame of its body. Set moves the centroid to the
+// origin, since that is where the body's position is, and computes the
+// edge normals once so the narrowphase doesn't have to.
+struct Polygon
+{
+	enum {MAX_VERTICES = 8};
+
+	// The points must be convex and counterclockwise.
+	void Set(const Vec2* points, int count);
+
+	// A box of width w centered on the origin, without the general case's
+	// square roots.
+	void SetBox(const Vec2& w);
+
+	// Edge i runs from vertices[i] to vertices[i + 1] and has outward
+	// normal normals[i].
+	Vec2 vertices[MAX_VERTICES];
+	Vec2 normals[MAX_VERTICES];
+	int count;
+
+	// Rotational inertia per unit mass about the centroid.
+	float inertia;
+
+	// Distance from the centroid to the farthest vertex.
+	float radius;
+};
+
+// One-sided segments in the frame of their body, for static terrain.
+// Segment i runs from vertex i to vertex i + 1 and collides only on its
+// left, so a chain running left to right is solid below. The vertices
+// before and after a segment are its ghost vertices: shapes sliding over
+// a joint are not pushed along normals that only the neighbouring segment
+// may use, so they don't catch on the joint.
+struct Chain
+{
+	enum {RUN_LENGTH = 8};
+
+	// A loop also joins the last point to the first. An open chain has no
+	// ghost vertex before its first segment or after its last.
+	void Set(const Vec2* points, int count, bool loop);
+
+	int SegmentCount() const { return loop ? (int)vertices.size() : (int)vertices.size() - 1; }
+
+	// Vertex i, wrapping around a loop.
+	const Vec2& Vertex(int i) const
+	{
+		int count = (int)vertices.size();
+		return vertices[(i + count) % count];
+	}
+
+	bool HasPrevious(int segment) const { return loop || segment > 0; }
+	bool HasNext(int segment) const { return loop || segment + 1 < SegmentCount(); }
+
+	// Appends the segments whose bounds overlap the box from lower to
+	// upper, given in the frame of the chain.
+	void Query(std::vector<int>* segments, const Vec2& lower, const Vec2& upper) const;
+
+	std::vector<Vec2> vertices;
+	bool loop;
+
+	// Bounds of each segment, and of each run of RUN_LENGTH segments. A
+	// query skips most of a long chain a run at a time.
+	std::vector<Vec2> lower, upper;
+	std::vector<Vec2> runLower, runUpper;
+};
+
+// Boxes of one density held rigidly together. Set moves the center of mass
+// to the origin, like Polygon::Set, and builds a bounding volume tree over
+// the boxes so a pair of bodies only collides the boxes that may touch.
+struct Compound
+{
+	enum {MAX_CHILDREN = 16};
+
+	struct Child
+	{
+		Vec2 position;
+		float rotation;
+		Vec2 width;
+
+		// Mat22(rotation) and the box as a polygon, set by Compound::Set.
+		Mat22 R;
+		Polygon polygon;
+	};
+
+	// A leaf holds a child; the others have two nodes below them.
+	struct Node
+	{
+		Vec2 lower, upper;
+		int node1, node2;
+		int child;
+	};
+
+	// Only the position, rotation and width of each box are read.
+	void Set(const Child* boxes, int count);
+
+	// Writes the children whose bounds overlap the box from lower to upper,
+	// given in the frame of the body, and returns their number.
+	int Query(int* result, const Vec2& lower, const Vec2& upper) const;
+
+	Child children[MAX_CHILDREN];
+	int count;
+
+	// The root is node 0.
+	Node nodes[2 * MAX_CHILDREN - 1];
+	int nodeCount;
+
+	// Rotational inertia per unit mass about the center of mass.
+	float inertia;
+
+	// Distance from the center of mass to the farthest corner.
+	float radius;
+};
+
 struct Body
 {
+	enum ShapeType
+	{
+		BOX,
+		CIRCLE,
+		POLYGON,
+		CHAIN,
+		COMPOUND,
+		SHAPE_COUNT
+	};
+
 	Body();
 	void Set(const Vec2& w, float m);
+	void SetCircle(float r, float m);
+
+	// The polygon is not copied and must outlive the body.
+	void SetPolygon(const Polygon* p, float m);
+
+	// A chain is always static. It is not copied and must outlive the body.
+	void SetChain(const Chain* c);
+
+	// The compound is not copied and must outlive the body.
+	void SetCompound(const Compound* c, float m);
 
 	void AddForce(const Vec2& f)
 	{
 		force += f;
 	}
 
+	// Static bodies are shared by islands that may be solved concurrently,
+	// so solvers never write to them. Their velocity cannot change anyway.
+	void StoreVelocity(const Vec2& v, float w)
+	{
+		if (invMass > 0.0f)
+		{
+			velocity = v;
+			angularVelocity = w;
+		}
+	}
+
+	void StoreBiasVelocity(const Vec2& v, float w)
+	{
+		if (invMass > 0.0f)
+		{
+			biasVelocity = v;
+			biasAngularVelocity = w;
+		}
+	}
+
+	// Position solver correction. deltaRotation follows the rotation.
+	void CorrectPosition(const Vec2& dp, float da)
+	{
+		if (invMass > 0.0f)
+		{
+			position += dp;
+			rotation += da;
+			deltaRotation = Mat22(da) * deltaRotation;
+		}
+	}
+
 	Vec2 position;
 	float rotation;
 
+	// Mat22(rotation), refreshed at the start of every step so the
+	// narrowphase and the pre-steps don't each take a sine and cosine.
+	// It is stale once the step has moved the body.
+	Mat22 rotationMatrix;
+
+	// Pose at the start of the step, for continuous collision.
+	Vec2 position0;
+	float rotation0;
+
 	Vec2 velocity;
 	float angularVelocity;
 
+	// Pseudo-velocity from split impulses. It moves the body for one step
+	// and is then discarded, so position correction adds no momentum.
+	Vec2 biasVelocity;
+	float biasAngularVelocity;
+
 	Vec2 force;
 	float torque;
 
-	Vec2 width;
+	ShapeType shape;
+
+	// boxPolygon is built from width, so call Set again to change it.
+	Vec2 width;		// for circles, polygons and compounds, the bounding square; for chains, twice the farthest vertex on each axis
+	float radius;	// circles only
+	const Polygon* polygon;	// polygons only
+	const Chain* chain;		// chains only
+	const Compound* compound;	// compounds only
+
+	// The box as a polygon, built from width by Set so the polygon routines
+	// don't rebuild it for every pair.
+	Polygon boxPolygon;
 
 	float friction;
 	float mass, invMass;
 	float I, invI;
+
+	// Always swept for continuous collision, however slow.
+	bool bullet;
+
+	// Collision filtering. Two bodies with the same nonzero group always
+	// collide if it is positive and never if it is negative. Otherwise they
+	// collide if each one's category is in the other's mask. Pairs that
+	// don't collide are dropped by the broadphase and get no arbiter.
+	unsigned int categoryBits;
+	unsigned int maskBits;
+	int groupIndex;
+
+	// Index into World::bodies, assigned every step.
+	int index;
+
+	// Contact and joint hops to the nearest static body, or -1 if the body
+	// doesn't rest on one. Only assigned when a solver option needs it.
+	int depth;
+
+	// Residual of the body's island at the end of the last step.
+	float residual;
+
+	// Rotation since the start of the step. Only the soft step solver and
+	// the position solver keep this up to date, and it stays the identity
+	// for static bodies.
+	Mat22 deltaRotation;
 };
 
 #endif
@@ -0,0 +1,125 @@
+/*
+* Copyright (c) 2006-2009 Erin Catto http://www.gphysics.com
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee,
+* provided that the above copyright notice appear in all copies.
+* Erin Catto makes no representations about the suitability
+* of this software for any purpose.
+* It is provided "as is" without express or implied warranty.
+*/
+
+#ifndef ISLAND_H
+#define ISLAND_H
+
+#include "MathUtils.h"
+
+struct Body;
+struct Joint;
+struct JointBatch;
+struct Arbiter;
+struct World;
+
+// A body or a joint in a joint tree. The nodes of a tree are stored
+// parents first, so walking them backwards eliminates leaves first.
+struct JointNode
+{
+	Body* body;		// set for body nodes
+	Joint* joint;	// set for joint nodes
+	int parent;		// -1 for the root
+
+	// Diagonal block of the system, replaced by its inverse when factored.
+	// Joint blocks are padded to 3x3 with a unit row.
+	Mat33 D;
+
+	// D^-1 times the block coupling the node to its parent.
+	Mat33 J;
+
+	Vec3 x;
+};
+
+// A set of dynamic bodies connected by contacts and joints, along with those
+// constraints. Static bodies are not part of any island, so islands share no
+// mutable state and can be solved in any order or concurrently.
+struct Island
+{
+	enum {MAX_REGIONS = 16};
+
+	// The Jacobi solver hands constraints and bodies to the thread pool in
+	// batches of this many, so large islands are solved by several threads.
+	enum {JACOBI_BATCH_SIZE = 64};
+
+	// Solve specialized on the accumulateImpulses, warmStarting and
+	// positionCorrection settings, chosen once per step.
+	typedef void (Island::*SolveFunction)(const World& world, float dt);
+	static SolveFunction SelectSolve(const World& world);
+
+	template <bool accumulate, bool warm, bool correct> void Solve(const World& world, float dt);
+	void SolveSoftStep(const World& world, float dt);
+	void SolvePositions(const World& world, float dt);
+
+	// Run the velocity iterations and return the residual of the last one.
+	template <bool accumulate> float SolveSequential(const World& world, int maxIterations);
+	template <bool accumulate> float SolveContacts(const World& world, int begin, int end);
+	float SolveJoints(int begin, int end);
+	template <bool accumulate> float SolveRegions(const World& world);
+	template <bool accumulate> float SolveJacobi(const World& world, int maxIterations);
+	void SplitMasses(bool split);
+
+	// Direct solver for the joints. The factorization depends only on the
+	// joint anchors and masses, so it is done once per step.
+	void FactorJointTree();
+	float SolveJointTree();
+
+	// One more pass over the contacts from the ground up, with the lower
+	// body of each contact treated as static.
+	void PropagateShock();
+
+	// Iterations to run when Settings::adaptiveIterations is on.
+	int IterationBudget(const World& world) const;
+
+	// Rough solver cost, used to schedule islands.
+	int Cost() const { return bodyCount + 4 * arbiterCount + 4 * jointCount; }
+
+	Body** bodies;
+	Arbiter** arbiters;
+	Joint** joints;
+	int bodyCount;
+	int arbiterCount;
+	int jointCount;
+
+	// Jacobi solver scratch. Constraint k, arbiters first, writes the
+	// velocity change of its bodies to deltas[2k] and deltas[2k + 1]. The
+	// slots summed into body b are deltaSlots[deltaOffsets[b->index]] up to
+	// deltaSlots[deltaOffsets[b->index + 1]]. Each batch of constraints
+	// writes its residual to residuals[batch].
+	VelocityDelta* deltas;
+	const int* deltaOffsets;
+	const int* deltaSlots;
+	float* residuals;
+
+	// Joint trees for the direct solver, empty if the joints form a loop or
+	// the direct solver is off.
+	JointNode* jointNodes;
+	int jointNodeCount;
+
+	// Joints packed for the SIMD solver, with room for one batch per joint.
+	JointBatch* jointBatches;
+	int jointBatchCount;
+
+	// Large islands may be split into regions of bodies. The constraints
+	// inside region r are arbiters[arbiterRegions[r]] up to
+	// arbiters[arbiterRegions[r + 1]], and likewise for the joints. The
+	// constraints between regions come after the last region.
+	const int* arbiterRegions;
+	const int* jointRegions;
+	int regionCount;
+
+	// Largest Body::depth in the island, if depths were assigned.
+	int depth;
+
+	// Solver passes actually run in the last Solve.
+	int iterationsUsed;
+};
+
+#endif
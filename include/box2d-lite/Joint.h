@@ -15,19 +15,33 @@
 #include "MathUtils.h"
 
 struct Body;
+struct World;
 
 struct Joint
 {
 	Joint() :
 		body1(0), body2(0),
 		P(0.0f, 0.0f),
-		biasFactor(0.2f), softness(0.0f)
+		biasFactor(0.2f), softness(0.0f),
+		stepSoftness(0.0f), stepBiasRate(0.0f)
 		{}
 
 	void Set(Body* body1, Body* body2, const Vec2& anchor);
 
-	void PreStep(float inv_dt);
-	void ApplyImpulse();
+	template <bool warm, bool correct> void PreStep(const World& world, float inv_dt);
+	// Rebuilds the mass matrix after the body masses were changed.
+	void UpdateMass();
+	// Returns the velocity error the impulse corrected.
+	float ApplyImpulse();
+	float ApplyJacobiImpulse(float relaxation, VelocityDelta* delta1, VelocityDelta* delta2);
+	// Position solver. Returns the anchor separation it corrected.
+	float SolvePosition();
+
+	// Soft step solver. Rigid joints use the given softness while user
+	// springs keep their softness and biasFactor, converted to the substep.
+	void PrepareSoft(const World& world, float dt, float h);
+	void WarmStart();
+	void SolveSoft(const Softness& jointSoftness, bool useBias);
 
 	Mat22 M;
 	Vec2 localAnchor1, localAnchor2;
@@ -38,6 +52,7 @@ struct Joint
 	Body* body2;
 	float biasFactor;
 	float softness;
+	float stepSoftness, stepBiasRate;	// softness and biasFactor / h for a substep
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,52 @@
+/*
+* Copyright (c) 2006-2009 Erin Catto http://www.gphysics.com
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee,
+* provided that the above copyright notice appear in all copies.
+* Erin Catto makes no representations about the suitability
+* of this software for any purpose.
+* It is provided "as is" without express or implied warranty.
+*/
+
+#ifndef JOINTBATCH_H
+#define JOINTBATCH_H
+
+struct Body;
+struct Joint;
+
+// Up to WIDTH joints that share no dynamic body, stored one lane per joint
+// so they can be solved together with SIMD. The lanes are filled from the
+// joints after Joint::PreStep and the accumulated impulses are written
+// back with Store.
+struct JointBatch
+{
+	enum {WIDTH = 4};
+
+	bool CanAdd(const Joint* joint) const;
+	void Add(Joint* joint);
+
+	// Returns the velocity error the impulses corrected.
+	float ApplyImpulse();
+	void Store();
+
+	Joint* joints[WIDTH];
+	Body* body1[WIDTH];
+	Body* body2[WIDTH];
+	int count;
+
+	float m11[WIDTH], m12[WIDTH], m21[WIDTH], m22[WIDTH];
+	float r1x[WIDTH], r1y[WIDTH];
+	float r2x[WIDTH], r2y[WIDTH];
+	float biasX[WIDTH], biasY[WIDTH];
+	float Px[WIDTH], Py[WIDTH];
+	float softness[WIDTH];
+	float invMass1[WIDTH], invI1[WIDTH];
+	float invMass2[WIDTH], invI2[WIDTH];
+};
+
+// Greedily packs the joints into conflict free batches and returns the
+// number of batches. There must be room for jointCount batches.
+int BatchJoints(Joint** joints, int jointCount, JointBatch* batches);
+
+#endif
@@ -26,7 +26,7 @@ struct Vec2
 
 	void Set(float x_, float y_) { x = x_; y = y_; }
 
-	Vec2 operator -() { return Vec2(-x, -y); }
+	Vec2 operator -() const { return Vec2(-x, -y); }
 	
 	void operator += (const Vec2& v)
 	{
@@ -51,6 +51,26 @@ struct Vec2
 	float x, y;
 };
 
+struct Vec3
+{
+	Vec3() {}
+	Vec3(float x, float y, float z) : x(x), y(y), z(z) {}
+
+	void Set(float x_, float y_, float z_) { x = x_; y = y_; z = z_; }
+
+	void operator += (const Vec3& v)
+	{
+		x += v.x; y += v.y; z += v.z;
+	}
+
+	void operator -= (const Vec3& v)
+	{
+		x -= v.x; y -= v.y; z -= v.z;
+	}
+
+	float x, y, z;
+};
+
 struct Mat22
 {
 	Mat22() {}
@@ -83,6 +103,38 @@ struct Mat22
 	Vec2 col1, col2;
 };
 
+struct Mat33
+{
+	Mat33() {}
+	Mat33(const Vec3& col1, const Vec3& col2, const Vec3& col3) : col1(col1), col2(col2), col3(col3) {}
+
+	Mat33 Transpose() const
+	{
+		return Mat33(Vec3(col1.x, col2.x, col3.x), Vec3(col1.y, col2.y, col3.y), Vec3(col1.z, col2.z, col3.z));
+	}
+
+	// The rows of the inverse are the cross products of the columns.
+	Mat33 Invert() const
+	{
+		const Vec3& a = col1;
+		const Vec3& b = col2;
+		const Vec3& c = col3;
+		Vec3 r1(b.y * c.z - b.z * c.y, b.z * c.x - b.x * c.z, b.x * c.y - b.y * c.x);
+		Vec3 r2(c.y * a.z - c.z * a.y, c.z * a.x - c.x * a.z, c.x * a.y - c.y * a.x);
+		Vec3 r3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+		float det = a.x * r1.x + a.y * r1.y + a.z * r1.z;
+		assert(det != 0.0f);
+		det = 1.0f / det;
+		Mat33 B;
+		B.col1.Set(det * r1.x, det * r2.x, det * r3.x);
+		B.col2.Set(det * r1.y, det * r2.y, det * r3.y);
+		B.col3.Set(det * r1.z, det * r2.z, det * r3.z);
+		return B;
+	}
+
+	Vec3 col1, col2, col3;
+};
+
 inline float Dot(const Vec2& a, const Vec2& b)
 {
 	return a.x * b.x + a.y * b.y;
@@ -133,6 +185,28 @@ inline Mat22 operator * (const Mat22& A, const Mat22& B)
 	return Mat22(A * B.col1, A * B.col2);
 }
 
+inline Vec3 operator * (const Mat33& A, const Vec3& v)
+{
+	return Vec3(A.col1.x * v.x + A.col2.x * v.y + A.col3.x * v.z,
+				A.col1.y * v.x + A.col2.y * v.y + A.col3.y * v.z,
+				A.col1.z * v.x + A.col2.z * v.y + A.col3.z * v.z);
+}
+
+inline Mat33 operator * (const Mat33& A, const Mat33& B)
+{
+	return Mat33(A * B.col1, A * B.col2, A * B.col3);
+}
+
+inline Vec3 operator - (const Vec3& a, const Vec3& b)
+{
+	return Vec3(a.x - b.x, a.y - b.y, a.z - b.z);
+}
+
+inline Mat33 operator - (const Mat33& A, const Mat33& B)
+{
+	return Mat33(A.col1 - B.col1, A.col2 - B.col2, A.col3 - B.col3);
+}
+
 inline float Abs(float a)
 {
 	return a > 0.0f ? a : -a;
@@ -163,6 +237,16 @@ inline float Max(float a, float b)
 	return a > b ? a : b;
 }
 
+inline Vec2 Min(const Vec2& a, const Vec2& b)
+{
+	return Vec2(Min(a.x, b.x), Min(a.y, b.y));
+}
+
+inline Vec2 Max(const Vec2& a, const Vec2& b)
+{
+	return Vec2(Max(a.x, b.x), Max(a.y, b.y));
+}
+
 inline float Clamp(float a, float low, float high)
 {
 	return Max(low, Min(a, high));
@@ -175,6 +259,39 @@ template<typename T> inline void Swap(T& a, T& b)
 	b = tmp;
 }
 
+// Coefficients of a soft constraint that behaves like a mass-spring-damper
+// with the given frequency and damping ratio, for an implicit step h. The
+// impulse is -massScale * m * (Cdot + biasRate * C) - impulseScale * P.
+struct Softness
+{
+	float biasRate;
+	float massScale;
+	float impulseScale;
+};
+
+inline Softness MakeSoft(float hertz, float dampingRatio, float h)
+{
+	Softness soft = {0.0f, 1.0f, 0.0f};
+	if (hertz == 0.0f)
+		return soft;
+
+	float omega = 2.0f * k_pi * hertz;
+	float a1 = 2.0f * dampingRatio + h * omega;
+	float a2 = h * omega * a1;
+	float a3 = 1.0f / (1.0f + a2);
+	soft.biasRate = omega / a1;
+	soft.massScale = a2 * a3;
+	soft.impulseScale = a3;
+	return soft;
+}
+
+// Velocity change a constraint asks of one of its bodies.
+struct VelocityDelta
+{
+	Vec2 v;
+	float w;
+};
+
 // Random number in range [-1,1]
 inline float Random()
 {
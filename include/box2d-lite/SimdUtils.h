@@ -0,0 +1,102 @@
+/*
+* Copyright (c) 2006-2009 Erin Catto http://www.gphysics.com
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee,
+* provided that the above copyright notice appear in all copies.
+* Erin Catto makes no representations about the suitability
+* of this software for any purpose.
+* It is provided "as is" without express or implied warranty.
+*/
+
+#ifndef SIMDUTILS_H
+#define SIMDUTILS_H
+
+// Four lanes of floats. SSE2 is part of every x64 target, other targets
+// use a plain loop the compiler may still vectorize.
+const int k_simdWidth = 4;
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+
+#include <emmintrin.h>
+
+typedef __m128 FloatW;
+
+static inline FloatW LoadW(const float* a) { return _mm_loadu_ps(a); }
+static inline void StoreW(float* a, FloatW b) { _mm_storeu_ps(a, b); }
+static inline FloatW SplatW(float a) { return _mm_set1_ps(a); }
+static inline FloatW AddW(FloatW a, FloatW b) { return _mm_add_ps(a, b); }
+static inline FloatW SubW(FloatW a, FloatW b) { return _mm_sub_ps(a, b); }
+static inline FloatW MulW(FloatW a, FloatW b) { return _mm_mul_ps(a, b); }
+static inline FloatW MaxW(FloatW a, FloatW b) { return _mm_max_ps(a, b); }
+static inline FloatW AbsW(FloatW a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+
+// Bit i is set if lane i of a is greater than lane i of b.
+static inline int GreaterMaskW(FloatW a, FloatW b) { return _mm_movemask_ps(_mm_cmpgt_ps(a, b)); }
+
+#else
+
+struct FloatW
+{
+	float v[k_simdWidth];
+};
+
+static inline FloatW LoadW(const float* a)
+{
+	FloatW r;
+	for (int i = 0; i < k_simdWidth; ++i) r.v[i] = a[i];
+	return r;
+}
+
+static inline void StoreW(float* a, FloatW b)
+{
+	for (int i = 0; i < k_simdWidth; ++i) a[i] = b.v[i];
+}
+
+static inline FloatW SplatW(float a)
+{
+	FloatW r;
+	for (int i = 0; i < k_simdWidth; ++i) r.v[i] = a;
+	return r;
+}
+
+static inline FloatW AddW(FloatW a, FloatW b)
+{
+	for (int i = 0; i < k_simdWidth; ++i) a.v[i] += b.v[i];
+	return a;
+}
+
+static inline FloatW SubW(FloatW a, FloatW b)
+{
+	for (int i = 0; i < k_simdWidth; ++i) a.v[i] -= b.v[i];
+	return a;
+}
+
+static inline FloatW MulW(FloatW a, FloatW b)
+{
+	for (int i = 0; i < k_simdWidth; ++i) a.v[i] *= b.v[i];
+	return a;
+}
+
+static inline FloatW MaxW(FloatW a, FloatW b)
+{
+	for (int i = 0; i < k_simdWidth; ++i) a.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i];
+	return a;
+}
+
+static inline FloatW AbsW(FloatW a)
+{
+	for (int i = 0; i < k_simdWidth; ++i) a.v[i] = a.v[i] > 0.0f ? a.v[i] : -a.v[i];
+	return a;
+}
+
+static inline int GreaterMaskW(FloatW a, FloatW b)
+{
+	int mask = 0;
+	for (int i = 0; i < k_simdWidth; ++i) mask |= a.v[i] > b.v[i] ? 1 << i : 0;
+	return mask;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,77 @@
+/*
+* Copyright (c) 2006-2009 Erin Catto http://www.gphysics.com
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee,
+* provided that the above copyright notice appear in all copies.
+* Erin Catto makes no representations about the suitability
+* of this software for any purpose.
+* It is provided "as is" without express or implied warranty.
+*/
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+typedef void TaskFunction(void* context, int index);
+
+// A pool of worker threads with one work-stealing deque per thread.
+// The thread calling ParallelFor takes part in the work, and ParallelFor
+// may be called from inside a task.
+struct ThreadPool
+{
+	// threadCount includes the calling thread, so 1 means no workers.
+	explicit ThreadPool(int threadCount);
+	~ThreadPool();
+
+	// Calls function(context, i) for every i in [0, count) and returns once all
+	// calls have finished. Low indices are started first, so callers should sort
+	// their work from most to least expensive.
+	void ParallelFor(TaskFunction* function, void* context, int count);
+
+	int GetThreadCount() const { return threadCount; }
+
+private:
+	struct Job
+	{
+		TaskFunction* function;
+		void* context;
+		std::atomic<int> remaining;
+	};
+
+	struct Task
+	{
+		Job* job;
+		int index;
+	};
+
+	struct WorkQueue
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	ThreadPool(const ThreadPool&);
+	void operator = (const ThreadPool&);
+
+	void WorkerMain(int slot);
+	bool RunTask(int slot);
+	int CurrentSlot() const;
+
+	int threadCount;
+	std::vector<WorkQueue*> queues;
+	std::vector<std::thread> threads;
+
+	std::mutex sleepMutex;
+	std::condition_variable wakeCondition;
+	std::atomic<int> queuedTasks;
+	bool stop;
+};
+
+#endif
@@ -0,0 +1,31 @@
+/*
+* Copyright (c) 2006-2009 Erin Catto http://www.gphysics.com
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee,
+* provided that the above copyright notice appear in all copies.
+* Erin Catto makes no representations about the suitability
+* of this software for any purpose.
+* It is provided "as is" without express or implied warranty.
+*/
+
+#ifndef TIMEOFIMPACT_H
+#define TIMEOFIMPACT_H
+
+#include "MathUtils.h"
+
+struct Body;
+
+// Distance between the shapes of two bodies at the given poses, or zero if
+// they overlap. The children name the segment of a chain.
+float Distance(const Body* bodyA, int childA, const Vec2& positionA, const Mat22& RotA,
+			   const Body* bodyB, int childB, const Vec2& positionB, const Mat22& RotB);
+
+// Conservative advancement of body from position0, rotation0 to its
+// current pose, against other held at its current pose. Returns the
+// fraction of the motion the body can make before its shape is just inside
+// the other's, or 1 if it never touches or already touched at the start.
+// The children name the box of a compound or the segment of a chain.
+float TimeOfImpact(const Body* body, int bodyChild, const Body* other, int otherChild);
+
+#endif
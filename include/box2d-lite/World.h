@@ -16,13 +16,61 @@
 #include <map>
 #include "MathUtils.h"
 #include "Arbiter.h"
+#include "Island.h"
+#include "JointBatch.h"
 
 struct Body;
 struct Joint;
+struct ThreadPool;
 
 struct World
 {
-	World(Vec2 gravity, int iterations) : gravity(gravity), iterations(iterations) {}
+	enum SolverType
+	{
+		SEQUENTIAL_IMPULSE,	// Baumgarte stabilized, iterations per step
+		SOFT_STEP,			// soft constraints, one iteration per substep
+		JACOBI,				// Baumgarte stabilized, constraints solved in parallel
+		MASS_SPLITTING		// as JACOBI, with each body's mass split among its constraints
+	};
+
+	// Solver switches. Each world has its own, so worlds with different
+	// settings can be stepped concurrently.
+	struct Settings
+	{
+		Settings() :
+			accumulateImpulses(true), warmStarting(true), positionCorrection(true), blockSolver(false),
+			splitImpulse(false), adaptiveIterations(false), directJointSolver(false), simdJointSolver(false),
+			shockPropagation(false), partitionIslands(false), positionSolver(false), continuousCollision(false),
+			speculativeContacts(false), solverType(SEQUENTIAL_IMPULSE) {}
+
+		bool accumulateImpulses;
+		bool warmStarting;
+		bool positionCorrection;
+		bool blockSolver;
+		bool splitImpulse;
+		bool adaptiveIterations;
+		bool directJointSolver;
+		bool simdJointSolver;
+
+		// The shock pass solves two-point manifolds as a block even when
+		// blockSolver is off, see Arbiter::ApplyShockImpulse.
+		bool shockPropagation;
+
+		bool partitionIslands;
+		bool positionSolver;
+		bool continuousCollision;
+
+		// Collide bodies that could touch within the step, so fast bodies
+		// stop at the gap instead of passing through.
+		bool speculativeContacts;
+
+		SolverType solverType;
+	};
+
+	World(Vec2 gravity, int iterations) :
+		gravity(gravity), iterations(iterations), minIterations(2), maxIterations(iterations), subSteps(4),
+		positionIterations(3), velocityTolerance(0.0f), jacobiRelaxation(0.5f), continuousDistance(0.1f),
+		iterationsUsed(0), threadPool(NULL) {}
 
 	void Add(Body* body);
 	void Add(Joint* joint);
@@ -30,16 +78,103 @@ struct World
 
 	void Step(float dt);
 
-	void BroadPhase();
+	void BroadPhase(float dt);
+	template <bool warm> void BroadPhase(float dt);
+	void NarrowPhase();
+	template <bool warm> void UpdateArbiters();
+	void BuildIslands();
+	void ComputeDepths();
+	void PartitionIslands();
+	void BuildDeltaLists();
+	void BuildJointTrees();
+	bool AddJointTree(Island* island, int root);
+	void SolveIslands(float dt);
+	void SolveContinuous();
 
 	std::vector<Body*> bodies;
 	std::vector<Joint*> joints;
 	std::map<ArbiterKey, Arbiter> arbiters;
 	Vec2 gravity;
 	int iterations;
-	static bool accumulateImpulses;
-	static bool warmStarting;
-	static bool positionCorrection;
+
+	// Bounds on the iterations an island may choose for itself when
+	// Settings::adaptiveIterations is on. iterations is ignored in that case.
+	int minIterations;
+	int maxIterations;
+
+	// Substeps per step for the soft step solver.
+	int subSteps;
+
+	// Most position iterations per step when Settings::positionSolver is on.
+	int positionIterations;
+
+	// An island stops iterating once a pass changes no relative velocity by
+	// more than this (m/s). At zero it only stops on an exact fixed point, so
+	// iterations is both the budget and the usual count.
+	float velocityTolerance;
+
+	// Fraction of each Jacobi impulse that is applied. Bodies with several
+	// constraints get the sum of all of them, so this must be well below 1
+	// for stacks to converge. Mass splitting needs no relaxation.
+	float jacobiRelaxation;
+
+	// With Settings::continuousCollision on, bodies that move farther than
+	// this in one step (m) are swept against the others like bullets.
+	float continuousDistance;
+
+	// The most iterations any island used in the last step.
+	int iterationsUsed;
+
+	// Candidate pairs are collided and islands solved on this pool when it
+	// is set. The pool is not owned and may be shared by several worlds.
+	ThreadPool* threadPool;
+
+	// Rebuilt every step. Each island points into the flat arrays below.
+	std::vector<Island> islands;
+	std::vector<Body*> islandBodies;
+	std::vector<Arbiter*> islandArbiters;
+	std::vector<Joint*> islandJoints;
+	std::vector<int> islandIds;
+	std::vector<int> islandOrder;
+	std::vector<int> islandTasks;
+	std::vector<int> bodyEdgeOffsets;
+	std::vector<int> bodyEdges;
+	std::vector<int> bodyQueue;
+	std::vector<VelocityDelta> jacobiDeltas;
+	std::vector<int> jacobiOffsets;
+	std::vector<int> jacobiSlots;
+	std::vector<float> jacobiResiduals;
+	std::vector<int> bodyJointOffsets;
+	std::vector<int> bodyJoints;
+	std::vector<int> bodyNodeIds;
+	std::vector<int> jointNodeIds;
+	std::vector<JointNode> jointNodes;
+	std::vector<JointBatch> jointBatches;
+	std::vector<int> bodyRegions;
+	std::vector<int> regionOffsets;
+	std::vector<Arbiter*> regionArbiters;
+	std::vector<Joint*> regionJoints;
+	std::vector<float> boundingRadii;
+
+	// Pairs found by the broadphase, and the touching ones found by each
+	// narrowphase task.
+	struct CollideTask
+	{
+		int begin, end;
+		std::vector<CollidePair> manifolds;
+	};
+
+	std::vector<CandidatePair> candidatePairs;
+	std::vector<CollideTask> collideTasks;
+
+	// The children of the bodies of a pair, see ArbiterKey.
+	std::vector<int> pairChildren1, pairChildren2;
+
+	// Step copies settings to stepSettings on entry and the solvers only
+	// read the copy, so settings may be changed at any time and take effect
+	// on the next step.
+	Settings settings;
+	Settings stepSettings;
 };
 
 #endif
@@ -23,6 +23,7 @@
 #include "box2d-lite/World.h"
 #include "box2d-lite/Body.h"
 #include "box2d-lite/Joint.h"
+#include "box2d-lite/ThreadPool.h"
 
 namespace
 {
@@ -30,6 +31,9 @@ namespace
 
 	Body bodies[200];
 	Joint joints[100];
+	Polygon polygons[Polygon::MAX_VERTICES - 2];
+	Chain terrain;
+	Compound compounds[2];
 	
 	Body* bomb = NULL;
 
@@ -72,16 +76,83 @@ static void DrawBody(Body* body)
 	Vec2 x = body->position;
 	Vec2 h = 0.5f * body->width;
 
-	Vec2 v1 = x + R * Vec2(-h.x, -h.y);
-	Vec2 v2 = x + R * Vec2( h.x, -h.y);
-	Vec2 v3 = x + R * Vec2( h.x,  h.y);
-	Vec2 v4 = x + R * Vec2(-h.x,  h.y);
-
 	if (body == bomb)
 		glColor3f(0.4f, 0.9f, 0.4f);
 	else
 		glColor3f(0.8f, 0.8f, 0.9f);
 
+	if (body->shape == Body::CIRCLE)
+	{
+		const int segments = 16;
+		glBegin(GL_LINE_LOOP);
+		for (int i = 0; i < segments; ++i)
+		{
+			float angle = 2.0f * k_pi * i / segments;
+			Vec2 v = x + body->radius * Vec2(cosf(angle), sinf(angle));
+			glVertex2f(v.x, v.y);
+		}
+		glEnd();
+
+		// A radius shows the rotation.
+		Vec2 r = x + R * Vec2(body->radius, 0.0f);
+		glBegin(GL_LINES);
+		glVertex2f(x.x, x.y);
+		glVertex2f(r.x, r.y);
+		glEnd();
+		return;
+	}
+
+	if (body->shape == Body::COMPOUND)
+	{
+		const Compound* compound = body->compound;
+		for (int i = 0; i < compound->count; ++i)
+		{
+			const Compound::Child& c = compound->children[i];
+			Vec2 p = x + R * c.position;
+			Mat22 Rc = R * c.R;
+			Vec2 hc = 0.5f * c.width;
+
+			glBegin(GL_LINE_LOOP);
+			for (int k = 0; k < 4; ++k)
+			{
+				Vec2 v = p + Rc * Vec2(k == 1 || k == 2 ? hc.x : -hc.x, k < 2 ? -hc.y : hc.y);
+				glVertex2f(v.x, v.y);
+			}
+			glEnd();
+		}
+		return;
+	}
+
+	if (body->shape == Body::CHAIN)
+	{
+		const Chain* chain = body->chain;
+		glBegin(chain->loop ? GL_LINE_LOOP : GL_LINE_STRIP);
+		for (int i = 0; i < (int)chain->vertices.size(); ++i)
+		{
+			Vec2 v = x + R * chain->vertices[i];
+			glVertex2f(v.x, v.y);
+		}
+		glEnd();
+		return;
+	}
+
+	if (body->shape == Body::POLYGON)
+	{
+		glBegin(GL_LINE_LOOP);
+		for (int i = 0; i < body->polygon->count; ++i)
+		{
+			Vec2 v = x + R * body->polygon->vertices[i];
+			glVertex2f(v.x, v.y);
+		}
+		glEnd();
+		return;
+	}
+
+	Vec2 v1 = x + R * Vec2(-h.x, -h.y);
+	Vec2 v2 = x + R * Vec2( h.x, -h.y);
+	Vec2 v3 = x + R * Vec2( h.x,  h.y);
+	Vec2 v4 = x + R * Vec2(-h.x,  h.y);
+
 	glBegin(GL_LINE_LOOP);
 	glVertex2f(v1.x, v1.y);
 	glVertex2f(v2.x, v2.y);
@@ -120,6 +191,7 @@ static void LaunchBomb()
 		bomb = bodies + numBodies;
 		bomb->Set(Vec2(1.0f, 1.0f), 50.0f);
 		bomb->friction = 0.2f;
+		bomb->bullet = true;
 		world.Add(bomb);
 		++numBodies;
 	}
@@ -495,7 +567,72 @@ static void Demo9(Body* b, Joint* j)
 	}
 }
 
-void (*demos[])(Body* b, Joint* j) = {Demo1, Demo2, Demo3, Demo4, Demo5, Demo6, Demo7, Demo8, Demo9};
+// Debris of circles, boxes and polygons
+static void Demo10(Body* b, Joint* j)
+{
+	// Regular polygons with 3 to 8 sides.
+	for (int i = 0; i < Polygon::MAX_VERTICES - 2; ++i)
+	{
+		int count = i + 3;
+		Vec2 points[Polygon::MAX_VERTICES];
+		for (int k = 0; k < count; ++k)
+		{
+			float angle = 2.0f * k_pi * k / count;
+			points[k].Set(0.4f * cosf(angle), 0.4f * sinf(angle));
+		}
+		polygons[i].Set(points, count);
+	}
+
+	// An L and a T, each one body.
+	Compound::Child boxes[3];
+	boxes[0].position.Set(0.0f, 0.0f);
+	boxes[0].rotation = 0.0f;
+	boxes[0].width.Set(0.9f, 0.25f);
+	boxes[1].position.Set(-0.325f, 0.4f);
+	boxes[1].rotation = 0.0f;
+	boxes[1].width.Set(0.25f, 0.55f);
+	compounds[0].Set(boxes, 2);
+	boxes[1].position.Set(0.0f, 0.4f);
+	compounds[1].Set(boxes, 2);
+
+	// A bin with a bumpy floor, all one chain. It runs left to right so
+	// the inside is in front.
+	Vec2 points[60];
+	int count = 0;
+	points[count++].Set(-7.0f, 8.0f);
+	for (int i = 0; i <= 56; ++i)
+	{
+		float x = -7.0f + 0.25f * i;
+		points[count++].Set(x, 0.3f * sinf(1.5f * x) + 0.02f * x * x);
+	}
+	points[count++].Set(7.0f, 8.0f);
+	terrain.Set(points, count, false);
+
+	b->SetChain(&terrain);
+	b->friction = 0.2f;
+	world.Add(b);
+	++b; ++numBodies;
+
+	for (int i = 0; i < 150; ++i)
+	{
+		if (i % 10 == 0)
+			b->Set(Vec2(Random(0.4f, 0.8f), Random(0.4f, 0.8f)), 1.0f);
+		else if (i % 10 == 5)
+			b->SetCompound(compounds + (i / 10) % 2, 1.0f);
+		else if (i % 5 == 1)
+			b->SetPolygon(polygons + (i / 5) % (Polygon::MAX_VERTICES - 2), 1.0f);
+		else
+			b->SetCircle(Random(0.2f, 0.4f), 1.0f);
+
+		b->friction = 0.4f;
+		b->position.Set(Random(-6.0f, 6.0f), 2.0f + 0.3f * i);
+		b->rotation = Random(-k_pi, k_pi);
+		world.Add(b);
+		++b; ++numBodies;
+	}
+}
+
+void (*demos[])(Body* b, Joint* j) = {Demo1, Demo2, Demo3, Demo4, Demo5, Demo6, Demo7, Demo8, Demo9, Demo10};
 const char* demoStrings[] = {
 	"Demo 1: A Single Box",
 	"Demo 2: Simple Pendulum",
@@ -505,7 +642,8 @@ const char* demoStrings[] = {
 	"Demo 6: A Teeter",
 	"Demo 7: A Suspension Bridge",
 	"Demo 8: Dominos",
-	"Demo 9: Multi-pendulum"};
+	"Demo 9: Multi-pendulum",
+	"Demo 10: Debris"};
 
 static void InitDemo(int index)
 {
@@ -544,16 +682,68 @@ static void Keyboard(GLFWwindow* window, int key, int scancode, int action, int
 		InitDemo(key - GLFW_KEY_1);
 		break;
 
+	case '0':
+		InitDemo(9);
+		break;
+
 	case GLFW_KEY_A:
-		World::accumulateImpulses = !World::accumulateImpulses;
+		world.settings.accumulateImpulses = !world.settings.accumulateImpulses;
 		break;
 
 	case GLFW_KEY_P:
-		World::positionCorrection = !World::positionCorrection;
+		world.settings.positionCorrection = !world.settings.positionCorrection;
 		break;
 
 	case GLFW_KEY_W:
-		World::warmStarting = !World::warmStarting;
+		world.settings.warmStarting = !world.settings.warmStarting;
+		break;
+
+	case GLFW_KEY_B:
+		world.settings.blockSolver = !world.settings.blockSolver;
+		break;
+
+	case GLFW_KEY_I:
+		world.settings.splitImpulse = !world.settings.splitImpulse;
+		break;
+
+	case GLFW_KEY_T:
+		world.settings.adaptiveIterations = !world.settings.adaptiveIterations;
+		break;
+
+	case GLFW_KEY_J:
+		world.settings.directJointSolver = !world.settings.directJointSolver;
+		break;
+
+	case GLFW_KEY_M:
+		world.settings.simdJointSolver = !world.settings.simdJointSolver;
+		break;
+
+	case GLFW_KEY_H:
+		world.settings.shockPropagation = !world.settings.shockPropagation;
+		break;
+
+	case GLFW_KEY_R:
+		world.settings.partitionIslands = !world.settings.partitionIslands;
+		break;
+
+	case GLFW_KEY_N:
+		world.settings.positionSolver = !world.settings.positionSolver;
+		break;
+
+	case GLFW_KEY_S:
+		world.settings.solverType = World::SolverType((world.settings.solverType + 1) % (World::MASS_SPLITTING + 1));
+		break;
+
+	case GLFW_KEY_C:
+		world.settings.continuousCollision = !world.settings.continuousCollision;
+		break;
+
+	case GLFW_KEY_V:
+		world.settings.speculativeContacts = !world.settings.speculativeContacts;
+		break;
+
+	case GLFW_KEY_E:
+		world.velocityTolerance = world.velocityTolerance > 0.0f ? 0.0f : 0.001f;
 		break;
 
 	case GLFW_KEY_SPACE:
@@ -645,6 +835,9 @@ int main(int, char**)
 		glOrtho(-zoom, zoom, -zoom / aspect + pan_y, zoom / aspect + pan_y, -1.0, 1.0);
 	}
 
+	ThreadPool threadPool((int)std::thread::hardware_concurrency());
+	world.threadPool = &threadPool;
+
 	InitDemo(0);
 
 	while (!glfwWindowShouldClose(mainWindow))
@@ -661,18 +854,62 @@ int main(int, char**)
 		ImGui::End();
 
 		DrawText(5, 5, demoStrings[demoIndex]);
-		DrawText(5, 35, "Keys: 1-9 Demos, Space to Launch the Bomb");
+		DrawText(5, 35, "Keys: 0-9 Demos, Space to Launch the Bomb");
 
 		char buffer[64];
-		sprintf(buffer, "(A)ccumulation %s", World::accumulateImpulses ? "ON" : "OFF");
+		sprintf(buffer, "(A)ccumulation %s", world.settings.accumulateImpulses ? "ON" : "OFF");
 		DrawText(5, 65, buffer);
 
-		sprintf(buffer, "(P)osition Correction %s", World::positionCorrection ? "ON" : "OFF");
+		sprintf(buffer, "(P)osition Correction %s", world.settings.positionCorrection ? "ON" : "OFF");
 		DrawText(5, 95, buffer);
 
-		sprintf(buffer, "(W)arm Starting %s", World::warmStarting ? "ON" : "OFF");
+		sprintf(buffer, "(W)arm Starting %s", world.settings.warmStarting ? "ON" : "OFF");
 		DrawText(5, 125, buffer);
 
+		sprintf(buffer, "(B)lock Solver %s", world.settings.blockSolver ? "ON" : "OFF");
+		DrawText(5, 155, buffer);
+
+		sprintf(buffer, "(E)arly Exit %s, %d of %d iterations", world.velocityTolerance > 0.0f ? "ON" : "OFF", world.iterationsUsed,
+			world.settings.adaptiveIterations ? world.maxIterations : world.iterations);
+		DrawText(5, 185, buffer);
+
+		if (world.settings.solverType == World::SOFT_STEP)
+			sprintf(buffer, "(S)olver Soft Step, %d substeps", world.subSteps);
+		else if (world.settings.solverType == World::JACOBI)
+			sprintf(buffer, "(S)olver Jacobi, relaxation %g", world.jacobiRelaxation);
+		else if (world.settings.solverType == World::MASS_SPLITTING)
+			sprintf(buffer, "(S)olver Mass Splitting");
+		else
+			sprintf(buffer, "(S)olver Sequential Impulse");
+		DrawText(5, 215, buffer);
+
+		sprintf(buffer, "Split (I)mpulse %s", world.settings.splitImpulse ? "ON" : "OFF");
+		DrawText(5, 245, buffer);
+
+		sprintf(buffer, "Adap(T)ive Iterations %s, %d to %d", world.settings.adaptiveIterations ? "ON" : "OFF", world.minIterations, world.maxIterations);
+		DrawText(5, 275, buffer);
+
+		sprintf(buffer, "Direct (J)oint Solver %s", world.settings.directJointSolver ? "ON" : "OFF");
+		DrawText(5, 305, buffer);
+
+		sprintf(buffer, "SI(M)D Joint Solver %s", world.settings.simdJointSolver ? "ON" : "OFF");
+		DrawText(5, 335, buffer);
+
+		sprintf(buffer, "S(H)ock Propagation %s", world.settings.shockPropagation ? "ON" : "OFF");
+		DrawText(5, 365, buffer);
+
+		sprintf(buffer, "Island (R)egions %s", world.settings.partitionIslands ? "ON" : "OFF");
+		DrawText(5, 395, buffer);
+
+		sprintf(buffer, "(N)onlinear Position Solver %s, %d iterations", world.settings.positionSolver ? "ON" : "OFF", world.positionIterations);
+		DrawText(5, 425, buffer);
+
+		sprintf(buffer, "(C)ontinuous Collision %s", world.settings.continuousCollision ? "ON" : "OFF");
+		DrawText(5, 455, buffer);
+
+		sprintf(buffer, "Speculati(v)e Contacts %s", world.settings.speculativeContacts ? "ON" : "OFF");
+		DrawText(5, 485, buffer);
+
 		glMatrixMode(GL_MODELVIEW);
 		glLoadIdentity();
 
@@ -26,18 +26,37 @@ Arbiter::Arbiter(Body* b1, Body* b2)
 		body2 = b1;
 	}
 
-	numContacts = Collide(contacts, body1, body2);
+	numContacts = Collide(contacts, body1, body2, 0, 0, 0.0f);
+
+	blockSolve = false;
+	paired = true;
+
+	friction = sqrtf(body1->friction * body2->friction);
+}
+
+Arbiter::Arbiter(const CollidePair& pair)
+{
+	body1 = pair.body1;
+	body2 = pair.body2;
+
+	numContacts = pair.numContacts;
+	for (int i = 0; i < numContacts; ++i)
+		contacts[i] = pair.contacts[i];
+
+	blockSolve = false;
+	paired = true;
 
 	friction = sqrtf(body1->friction * body2->friction);
 }
 
-void Arbiter::Update(Contact* newContacts, int numNewContacts)
+template <bool warm>
+void Arbiter::Update(const Contact* newContacts, int numNewContacts)
 {
 	Contact mergedContacts[2];
 
 	for (int i = 0; i < numNewContacts; ++i)
 	{
-		Contact* cNew = newContacts + i;
+		const Contact* cNew = newContacts + i;
 		int k = -1;
 		for (int j = 0; j < numContacts; ++j)
 		{
@@ -54,7 +73,7 @@ void Arbiter::Update(Contact* newContacts, int numNewContacts)
 			Contact* c = mergedContacts + i;
 			Contact* cOld = contacts + k;
 			*c = *cNew;
-			if (World::warmStarting)
+			if (warm)
 			{
 				c->Pn = cOld->Pn;
 				c->Pt = cOld->Pt;
@@ -80,53 +99,217 @@ void Arbiter::Update(Contact* newContacts, int numNewContacts)
 }
 
 
-void Arbiter::PreStep(float inv_dt)
+// Precompute anchors, normal mass and tangent mass.
+static void ComputeMass(Contact* c, const Body* body1, const Body* body2)
+{
+	Vec2 r1 = c->position - body1->position;
+	Vec2 r2 = c->position - body2->position;
+	c->r1 = r1;
+	c->r2 = r2;
+
+	float rn1 = Dot(r1, c->normal);
+	float rn2 = Dot(r2, c->normal);
+	float kNormal = body1->invMass + body2->invMass;
+	kNormal += body1->invI * (Dot(r1, r1) - rn1 * rn1) + body2->invI * (Dot(r2, r2) - rn2 * rn2);
+	c->massNormal = 1.0f / kNormal;
+
+	Vec2 tangent = Cross(c->normal, 1.0f);
+	float rt1 = Dot(r1, tangent);
+	float rt2 = Dot(r2, tangent);
+	float kTangent = body1->invMass + body2->invMass;
+	kTangent += body1->invI * (Dot(r1, r1) - rt1 * rt1) + body2->invI * (Dot(r2, r2) - rt2 * rt2);
+	c->massTangent = 1.0f /  kTangent;
+}
+
+template <bool accumulate, bool correct>
+void Arbiter::PreStep(const World& world, float inv_dt)
 {
 	const float k_allowedPenetration = 0.01f;
-	float k_biasFactor = World::positionCorrection ? 0.2f : 0.0f;
+	float k_biasFactor = correct && world.stepSettings.positionSolver == false ? 0.2f : 0.0f;
+
+	// Only the sequential solver runs the pseudo-velocity pass, and not
+	// when the position solver removes the overlap instead.
+	bool splitImpulse = world.stepSettings.splitImpulse && world.stepSettings.solverType == World::SEQUENTIAL_IMPULSE &&
+		world.stepSettings.positionSolver == false;
+
+	Vec2 v1 = body1->velocity, v2 = body2->velocity;
+	float w1 = body1->angularVelocity, w2 = body2->angularVelocity;
+	Vec2 vb1 = body1->biasVelocity, vb2 = body2->biasVelocity;
+	float wb1 = body1->biasAngularVelocity, wb2 = body2->biasAngularVelocity;
 
 	for (int i = 0; i < numContacts; ++i)
 	{
 		Contact* c = contacts + i;
 
-		Vec2 r1 = c->position - body1->position;
-		Vec2 r2 = c->position - body2->position;
-
 		// Precompute normal mass, tangent mass, and bias.
-		float rn1 = Dot(r1, c->normal);
-		float rn2 = Dot(r2, c->normal);
-		float kNormal = body1->invMass + body2->invMass;
-		kNormal += body1->invI * (Dot(r1, r1) - rn1 * rn1) + body2->invI * (Dot(r2, r2) - rn2 * rn2);
-		c->massNormal = 1.0f / kNormal;
+		ComputeMass(c, body1, body2);
 
+		Vec2 r1 = c->r1;
+		Vec2 r2 = c->r2;
 		Vec2 tangent = Cross(c->normal, 1.0f);
-		float rt1 = Dot(r1, tangent);
-		float rt2 = Dot(r2, tangent);
-		float kTangent = body1->invMass + body2->invMass;
-		kTangent += body1->invI * (Dot(r1, r1) - rt1 * rt1) + body2->invI * (Dot(r2, r2) - rt2 * rt2);
-		c->massTangent = 1.0f /  kTangent;
 
 		c->bias = -k_biasFactor * inv_dt * Min(0.0f, c->separation + k_allowedPenetration);
+		c->positionBias = 0.0f;
+
+		if (splitImpulse)
+		{
+			// Correct the overlap with pseudo-velocities instead.
+			c->positionBias = c->bias;
+			c->bias = 0.0f;
+		}
+		else
+		{
+			// Don't warm start the pass with impulses from before it was
+			// switched off.
+			c->Pnb = 0.0f;
+		}
+
+		// A speculative contact is not touching yet. The bodies may approach
+		// by the gap this step but no further.
+		if (c->separation > 0.0f)
+			c->bias = -inv_dt * c->separation;
 
-		if (World::accumulateImpulses)
+		if (accumulate)
 		{
 			// Apply normal + friction impulse
 			Vec2 P = c->Pn * c->normal + c->Pt * tangent;
 
-			body1->velocity -= body1->invMass * P;
-			body1->angularVelocity -= body1->invI * Cross(r1, P);
+			v1 -= body1->invMass * P;
+			w1 -= body1->invI * Cross(r1, P);
+
+			v2 += body2->invMass * P;
+			w2 += body2->invI * Cross(r2, P);
+
+			if (splitImpulse)
+			{
+				Vec2 Pb = c->Pnb * c->normal;
+
+				vb1 -= body1->invMass * Pb;
+				wb1 -= body1->invI * Cross(r1, Pb);
 
-			body2->velocity += body2->invMass * P;
-			body2->angularVelocity += body2->invI * Cross(r2, P);
+				vb2 += body2->invMass * Pb;
+				wb2 += body2->invI * Cross(r2, Pb);
+			}
 		}
 	}
+
+	body1->StoreVelocity(v1, w1);
+	body2->StoreVelocity(v2, w2);
+
+	if (splitImpulse)
+	{
+		body1->StoreBiasVelocity(vb1, wb1);
+		body2->StoreBiasVelocity(vb2, wb2);
+	}
+
+	blockSolve = false;
+	if (world.stepSettings.blockSolver && accumulate && numContacts == 2)
+	{
+		PrepareBlockSolve();
+	}
+}
+
+// Solve both normal impulses together, unless the points are so close
+// that the mass matrix is nearly singular.
+void Arbiter::PrepareBlockSolve()
+{
+	const float k_maxConditionNumber = 1000.0f;
+
+	Contact* c1 = contacts + 0;
+	Contact* c2 = contacts + 1;
+
+	float rn11 = Cross(c1->position - body1->position, c1->normal);
+	float rn12 = Cross(c2->position - body1->position, c2->normal);
+	float rn21 = Cross(c1->position - body2->position, c1->normal);
+	float rn22 = Cross(c2->position - body2->position, c2->normal);
+
+	float invMass = body1->invMass + body2->invMass;
+	float k11 = invMass + body1->invI * rn11 * rn11 + body2->invI * rn21 * rn21;
+	float k22 = invMass + body1->invI * rn12 * rn12 + body2->invI * rn22 * rn22;
+	float k12 = invMass + body1->invI * rn11 * rn12 + body2->invI * rn21 * rn22;
+
+	if (k11 * k11 < k_maxConditionNumber * (k11 * k22 - k12 * k12))
+	{
+		K.col1.Set(k11, k12);
+		K.col2.Set(k12, k22);
+		normalMass = K.Invert();
+		blockSolve = true;
+	}
+}
+
+void Arbiter::UpdateMass()
+{
+	for (int i = 0; i < numContacts; ++i)
+	{
+		ComputeMass(contacts + i, body1, body2);
+	}
+
+	if (blockSolve)
+	{
+		blockSolve = false;
+		PrepareBlockSolve();
+	}
+}
+
+template <bool accumulate>
+float Arbiter::ApplyImpulse()
+{
+	Vec2 v1 = body1->velocity, v2 = body2->velocity;
+	float w1 = body1->angularVelocity, w2 = body2->angularVelocity;
+
+	float residual = SolveVelocity<accumulate>(v1, w1, v2, w2);
+
+	body1->StoreVelocity(v1, w1);
+	body2->StoreVelocity(v2, w2);
+
+	return residual;
+}
+
+template <bool accumulate>
+float Arbiter::ApplyJacobiImpulse(float relaxation, VelocityDelta* delta1, VelocityDelta* delta2)
+{
+	float Pn0[MAX_POINTS], Pt0[MAX_POINTS];
+	for (int i = 0; i < numContacts; ++i)
+	{
+		Pn0[i] = contacts[i].Pn;
+		Pt0[i] = contacts[i].Pt;
+	}
+
+	Vec2 v1 = body1->velocity, v2 = body2->velocity;
+	float w1 = body1->angularVelocity, w2 = body2->angularVelocity;
+
+	float residual = SolveVelocity<accumulate>(v1, w1, v2, w2);
+
+	// The velocity change is linear in the impulse, so relax both by the
+	// same factor. A blend of two clamped impulses is still clamped.
+	for (int i = 0; i < numContacts; ++i)
+	{
+		Contact* c = contacts + i;
+		c->Pn = Pn0[i] + relaxation * (c->Pn - Pn0[i]);
+		c->Pt = Pt0[i] + relaxation * (c->Pt - Pt0[i]);
+	}
+
+	delta1->v = relaxation * (v1 - body1->velocity);
+	delta1->w = relaxation * (w1 - body1->angularVelocity);
+	delta2->v = relaxation * (v2 - body2->velocity);
+	delta2->w = relaxation * (w2 - body2->angularVelocity);
+
+	return residual;
 }
 
-void Arbiter::ApplyImpulse()
+template <bool accumulate>
+float Arbiter::SolveVelocity(Vec2& v1, float& w1, Vec2& v2, float& w2)
 {
+	if (blockSolve)
+	{
+		return SolveBlockVelocity(v1, w1, v2, w2);
+	}
+
 	Body* b1 = body1;
 	Body* b2 = body2;
 
+	float residual = 0.0f;
+
 	for (int i = 0; i < numContacts; ++i)
 	{
 		Contact* c = contacts + i;
@@ -134,14 +317,14 @@ void Arbiter::ApplyImpulse()
 		c->r2 = c->position - b2->position;
 
 		// Relative velocity at contact
-		Vec2 dv = b2->velocity + Cross(b2->angularVelocity, c->r2) - b1->velocity - Cross(b1->angularVelocity, c->r1);
+		Vec2 dv = v2 + Cross(w2, c->r2) - v1 - Cross(w1, c->r1);
 
 		// Compute normal impulse
 		float vn = Dot(dv, c->normal);
 
 		float dPn = c->massNormal * (-vn + c->bias);
 
-		if (World::accumulateImpulses)
+		if (accumulate)
 		{
 			// Clamp the accumulated impulse
 			float Pn0 = c->Pn;
@@ -156,20 +339,20 @@ void Arbiter::ApplyImpulse()
 		// Apply contact impulse
 		Vec2 Pn = dPn * c->normal;
 
-		b1->velocity -= b1->invMass * Pn;
-		b1->angularVelocity -= b1->invI * Cross(c->r1, Pn);
+		v1 -= b1->invMass * Pn;
+		w1 -= b1->invI * Cross(c->r1, Pn);
 
-		b2->velocity += b2->invMass * Pn;
-		b2->angularVelocity += b2->invI * Cross(c->r2, Pn);
+		v2 += b2->invMass * Pn;
+		w2 += b2->invI * Cross(c->r2, Pn);
 
 		// Relative velocity at contact
-		dv = b2->velocity + Cross(b2->angularVelocity, c->r2) - b1->velocity - Cross(b1->angularVelocity, c->r1);
+		dv = v2 + Cross(w2, c->r2) - v1 - Cross(w1, c->r1);
 
 		Vec2 tangent = Cross(c->normal, 1.0f);
 		float vt = Dot(dv, tangent);
 		float dPt = c->massTangent * (-vt);
 
-		if (World::accumulateImpulses)
+		if (accumulate)
 		{
 			// Compute friction impulse
 			float maxPt = friction * c->Pn;
@@ -188,10 +371,417 @@ void Arbiter::ApplyImpulse()
 		// Apply contact impulse
 		Vec2 Pt = dPt * tangent;
 
-		b1->velocity -= b1->invMass * Pt;
-		b1->angularVelocity -= b1->invI * Cross(c->r1, Pt);
+		v1 -= b1->invMass * Pt;
+		w1 -= b1->invI * Cross(c->r1, Pt);
+
+		v2 += b2->invMass * Pt;
+		w2 += b2->invI * Cross(c->r2, Pt);
+
+		residual = Max(residual, Max(Abs(dPn) / c->massNormal, Abs(dPt) / c->massTangent));
+	}
+
+	return residual;
+}
+
+// The island has frozen the body nearer the ground, so the effective masses
+// have changed and the block solver's matrix must be rebuilt. Only the normal
+// impulses are solved. They are not kept: they correct this step only and
+// would push the frozen body down if they warm started the next one.
+//
+// This pass always solves two-point manifolds as a block, whatever
+// Settings::blockSolver is set to. Solving the points one at a time
+// against a frozen body rocks the box on it. A stack of 20 boxes at 10
+// iterations then ends up worse than without shock propagation.
+float Arbiter::ApplyShockImpulse()
+{
+	Body* b1 = body1;
+	Body* b2 = body2;
+
+	for (int i = 0; i < numContacts; ++i)
+	{
+		ComputeMass(contacts + i, b1, b2);
+	}
+
+	blockSolve = false;
+	if (numContacts == 2)
+		PrepareBlockSolve();
+
+	float Pn0[MAX_POINTS];
+	for (int i = 0; i < numContacts; ++i)
+		Pn0[i] = contacts[i].Pn;
+
+	Vec2 v1 = b1->velocity, v2 = b2->velocity;
+	float w1 = b1->angularVelocity, w2 = b2->angularVelocity;
+
+	float residual = 0.0f;
+
+	if (blockSolve)
+	{
+		residual = SolveBlockNormal(v1, w1, v2, w2);
+	}
+	else
+	{
+		for (int i = 0; i < numContacts; ++i)
+		{
+			Contact* c = contacts + i;
+
+			Vec2 dv = v2 + Cross(w2, c->r2) - v1 - Cross(w1, c->r1);
+			float vn = Dot(dv, c->normal);
+			float dPn = c->massNormal * (-vn + c->bias);
+
+			float Pn = c->Pn;
+			c->Pn = Max(Pn + dPn, 0.0f);
+			dPn = c->Pn - Pn;
+
+			Vec2 P = dPn * c->normal;
+
+			v1 -= b1->invMass * P;
+			w1 -= b1->invI * Cross(c->r1, P);
+
+			v2 += b2->invMass * P;
+			w2 += b2->invI * Cross(c->r2, P);
+
+			residual = Max(residual, Abs(dPn) / c->massNormal);
+		}
+	}
+
+	for (int i = 0; i < numContacts; ++i)
+		contacts[i].Pn = Pn0[i];
+
+	b1->StoreVelocity(v1, w1);
+	b2->StoreVelocity(v2, w2);
+
+	return residual;
+}
+
+// Solves the non-penetration constraints at the position level by
+// applying impulses to the pseudo-velocities only.
+template <bool accumulate>
+float Arbiter::ApplyBiasImpulse()
+{
+	Body* b1 = body1;
+	Body* b2 = body2;
+
+	Vec2 vb1 = b1->biasVelocity, vb2 = b2->biasVelocity;
+	float wb1 = b1->biasAngularVelocity, wb2 = b2->biasAngularVelocity;
+
+	float residual = 0.0f;
+
+	for (int i = 0; i < numContacts; ++i)
+	{
+		Contact* c = contacts + i;
+
+		// Relative pseudo-velocity at contact
+		Vec2 dvb = vb2 + Cross(wb2, c->r2) - vb1 - Cross(wb1, c->r1);
+
+		float vnb = Dot(dvb, c->normal);
+		float dPnb = c->massNormal * (-vnb + c->positionBias);
+
+		if (accumulate)
+		{
+			float Pnb0 = c->Pnb;
+			c->Pnb = Max(Pnb0 + dPnb, 0.0f);
+			dPnb = c->Pnb - Pnb0;
+		}
+		else
+		{
+			dPnb = Max(dPnb, 0.0f);
+		}
+
+		Vec2 Pb = dPnb * c->normal;
+
+		vb1 -= b1->invMass * Pb;
+		wb1 -= b1->invI * Cross(c->r1, Pb);
+
+		vb2 += b2->invMass * Pb;
+		wb2 += b2->invI * Cross(c->r2, Pb);
+
+		residual = Max(residual, Abs(dPnb) / c->massNormal);
+	}
+
+	b1->StoreBiasVelocity(vb1, wb1);
+	b2->StoreBiasVelocity(vb2, wb2);
+
+	return residual;
+}
+
+// Nonlinear Gauss-Seidel on the separation. The anchors are carried along
+// by the bodies' motion since the start of the step, as in SolveSoft, so
+// every correction sees the moves made before it.
+float Arbiter::SolvePosition()
+{
+	const float k_allowedPenetration = 0.01f;
+	const float k_biasFactor = 0.2f;
+	const float k_maxCorrection = 0.2f;
+
+	Body* b1 = body1;
+	Body* b2 = body2;
+
+	float error = 0.0f;
+
+	for (int i = 0; i < numContacts; ++i)
+	{
+		Contact* c = contacts + i;
+
+		Vec2 r1 = b1->deltaRotation * c->r1;
+		Vec2 r2 = b2->deltaRotation * c->r2;
+		Vec2 d = b2->position + r2 - b1->position - r1;
+		float separation = c->separation + Dot(d, c->normal);
+
+		error = Max(error, -(separation + k_allowedPenetration));
+
+		// Push apart by a fraction of the overlap, like the velocity bias.
+		float C = Clamp(k_biasFactor * (separation + k_allowedPenetration), -k_maxCorrection, 0.0f);
+
+		float rn1 = Cross(r1, c->normal);
+		float rn2 = Cross(r2, c->normal);
+		float k = b1->invMass + b2->invMass + b1->invI * rn1 * rn1 + b2->invI * rn2 * rn2;
+		if (k == 0.0f)
+			continue;
+
+		Vec2 P = (-C / k) * c->normal;
+
+		b1->CorrectPosition(-b1->invMass * P, -b1->invI * Cross(r1, P));
+		b2->CorrectPosition(b2->invMass * P, b2->invI * Cross(r2, P));
+	}
+
+	return error;
+}
+
+void Arbiter::PrepareSoft()
+{
+	for (int i = 0; i < numContacts; ++i)
+	{
+		ComputeMass(contacts + i, body1, body2);
+	}
+}
+
+void Arbiter::WarmStart()
+{
+	Vec2 v1 = body1->velocity, v2 = body2->velocity;
+	float w1 = body1->angularVelocity, w2 = body2->angularVelocity;
+
+	for (int i = 0; i < numContacts; ++i)
+	{
+		Contact* c = contacts + i;
+
+		Vec2 P = c->Pn * c->normal + c->Pt * Cross(c->normal, 1.0f);
+
+		v1 -= body1->invMass * P;
+		w1 -= body1->invI * Cross(c->r1, P);
+
+		v2 += body2->invMass * P;
+		w2 += body2->invI * Cross(c->r2, P);
+	}
+
+	body1->StoreVelocity(v1, w1);
+	body2->StoreVelocity(v2, w2);
+}
+
+void Arbiter::SolveSoft(const Softness& softness, float inv_h, bool useBias)
+{
+	const float k_allowedPenetration = 0.01f;
+	const float k_maxPushVelocity = 3.0f;
+
+	Body* b1 = body1;
+	Body* b2 = body2;
+
+	Vec2 v1 = b1->velocity, v2 = b2->velocity;
+	float w1 = b1->angularVelocity, w2 = b2->angularVelocity;
+
+	for (int i = 0; i < numContacts; ++i)
+	{
+		Contact* c = contacts + i;
+
+		// The anchors started out at the same point, so their distance
+		// along the normal is how far the separation has changed.
+		Vec2 d = b2->position + b2->deltaRotation * c->r2 - b1->position - b1->deltaRotation * c->r1;
+		float s = c->separation + Dot(d, c->normal);
+
+		float bias = 0.0f;
+		float massScale = 1.0f;
+		float impulseScale = 0.0f;
+		if (s > 0.0f)
+		{
+			// Separated, only allow approach up to the gap.
+			bias = s * inv_h;
+		}
+		else if (useBias)
+		{
+			bias = Max(softness.biasRate * Min(0.0f, s + k_allowedPenetration), -k_maxPushVelocity);
+			massScale = softness.massScale;
+			impulseScale = softness.impulseScale;
+		}
+
+		// Relative velocity at contact
+		Vec2 dv = v2 + Cross(w2, c->r2) - v1 - Cross(w1, c->r1);
+
+		// Compute normal impulse
+		float vn = Dot(dv, c->normal);
+		float dPn = -c->massNormal * massScale * (vn + bias) - impulseScale * c->Pn;
+
+		// Clamp the accumulated impulse
+		float Pn0 = c->Pn;
+		c->Pn = Max(Pn0 + dPn, 0.0f);
+		dPn = c->Pn - Pn0;
+
+		// Apply contact impulse
+		Vec2 Pn = dPn * c->normal;
+
+		v1 -= b1->invMass * Pn;
+		w1 -= b1->invI * Cross(c->r1, Pn);
+
+		v2 += b2->invMass * Pn;
+		w2 += b2->invI * Cross(c->r2, Pn);
+
+		// Relative velocity at contact
+		dv = v2 + Cross(w2, c->r2) - v1 - Cross(w1, c->r1);
+
+		Vec2 tangent = Cross(c->normal, 1.0f);
+		float vt = Dot(dv, tangent);
+		float dPt = c->massTangent * (-vt);
+
+		// Clamp friction
+		float maxPt = friction * c->Pn;
+		float oldTangentImpulse = c->Pt;
+		c->Pt = Clamp(oldTangentImpulse + dPt, -maxPt, maxPt);
+		dPt = c->Pt - oldTangentImpulse;
+
+		// Apply contact impulse
+		Vec2 Pt = dPt * tangent;
+
+		v1 -= b1->invMass * Pt;
+		w1 -= b1->invI * Cross(c->r1, Pt);
+
+		v2 += b2->invMass * Pt;
+		w2 += b2->invI * Cross(c->r2, Pt);
+	}
+
+	b1->StoreVelocity(v1, w1);
+	b2->StoreVelocity(v2, w2);
+}
+
+// Solves the normal impulses of both points as a 2x2 LCP by trying each
+// combination of active points in turn:
+//
+// vn = K * x + b, vn >= 0, x >= 0, vn_i * x_i = 0
+//
+// Here x is the total normal impulse and b is the relative normal
+// velocity, minus the bias, with the accumulated impulse removed.
+float Arbiter::SolveBlockNormal(Vec2& v1, float& w1, Vec2& v2, float& w2)
+{
+	Body* b1 = body1;
+	Body* b2 = body2;
+
+	Contact* c1 = contacts + 0;
+	Contact* c2 = contacts + 1;
+	c1->r1 = c1->position - b1->position;
+	c1->r2 = c1->position - b2->position;
+	c2->r1 = c2->position - b1->position;
+	c2->r2 = c2->position - b2->position;
+
+	Vec2 normal = c1->normal;
+
+	// Relative normal velocity at each contact
+	Vec2 dv1 = v2 + Cross(w2, c1->r2) - v1 - Cross(w1, c1->r1);
+	Vec2 dv2 = v2 + Cross(w2, c2->r2) - v1 - Cross(w1, c2->r1);
+
+	Vec2 a(c1->Pn, c2->Pn);
+	Vec2 b(Dot(dv1, normal) - c1->bias, Dot(dv2, normal) - c2->bias);
+	b -= K * a;
+
+	Vec2 x;
+	for (;;)
+	{
+		// Case 1: both points are active.
+		x = -(normalMass * b);
+		if (x.x >= 0.0f && x.y >= 0.0f)
+			break;
+
+		// Case 2: only the first point is active.
+		x.Set(-c1->massNormal * b.x, 0.0f);
+		float vn2 = K.col1.y * x.x + b.y;
+		if (x.x >= 0.0f && vn2 >= 0.0f)
+			break;
+
+		// Case 3: only the second point is active.
+		x.Set(0.0f, -c2->massNormal * b.y);
+		float vn1 = K.col2.x * x.y + b.x;
+		if (x.y >= 0.0f && vn1 >= 0.0f)
+			break;
+
+		// Case 4: both points are separating.
+		x.Set(0.0f, 0.0f);
+		if (b.x >= 0.0f && b.y >= 0.0f)
+			break;
+
+		// No solution, this can only happen through roundoff.
+		x = a;
+		break;
+	}
+
+	// Apply the incremental impulse
+	Vec2 d = x - a;
+	Vec2 P1 = d.x * normal;
+	Vec2 P2 = d.y * normal;
+
+	v1 -= b1->invMass * (P1 + P2);
+	w1 -= b1->invI * (Cross(c1->r1, P1) + Cross(c2->r1, P2));
+
+	v2 += b2->invMass * (P1 + P2);
+	w2 += b2->invI * (Cross(c1->r2, P1) + Cross(c2->r2, P2));
+
+	c1->Pn = x.x;
+	c2->Pn = x.y;
+
+	return Max(Abs(d.x) * K.col1.x, Abs(d.y) * K.col2.y);
+}
+
+float Arbiter::SolveBlockVelocity(Vec2& v1, float& w1, Vec2& v2, float& w2)
+{
+	Body* b1 = body1;
+	Body* b2 = body2;
+
+	float residual = SolveBlockNormal(v1, w1, v2, w2);
+
+	// Friction is solved per point, clamped by the new normal impulses.
+	Vec2 tangent = Cross(contacts[0].normal, 1.0f);
+	for (int i = 0; i < 2; ++i)
+	{
+		Contact* c = contacts + i;
+
+		Vec2 dv = v2 + Cross(w2, c->r2) - v1 - Cross(w1, c->r1);
+		float vt = Dot(dv, tangent);
+		float dPt = c->massTangent * (-vt);
+
+		float maxPt = friction * c->Pn;
+		float oldTangentImpulse = c->Pt;
+		c->Pt = Clamp(oldTangentImpulse + dPt, -maxPt, maxPt);
+		dPt = c->Pt - oldTangentImpulse;
+
+		Vec2 Pt = dPt * tangent;
+
+		v1 -= b1->invMass * Pt;
+		w1 -= b1->invI * Cross(c->r1, Pt);
+
+		v2 += b2->invMass * Pt;
+		w2 += b2->invI * Cross(c->r2, Pt);
 
-		b2->velocity += b2->invMass * Pt;
-		b2->angularVelocity += b2->invI * Cross(c->r2, Pt);
+		residual = Max(residual, Abs(dPt) / c->massTangent);
 	}
+
+	return residual;
 }
+
+template void Arbiter::Update<false>(const Contact* newContacts, int numNewContacts);
+template void Arbiter::Update<true>(const Contact* newContacts, int numNewContacts);
+template void Arbiter::PreStep<false, false>(const World& world, float inv_dt);
+template void Arbiter::PreStep<false, true>(const World& world, float inv_dt);
+template void Arbiter::PreStep<true, false>(const World& world, float inv_dt);
+template void Arbiter::PreStep<true, true>(const World& world, float inv_dt);
+template float Arbiter::ApplyImpulse<false>();
+template float Arbiter::ApplyImpulse<true>();
+template float Arbiter::ApplyBiasImpulse<false>();
+template float Arbiter::ApplyBiasImpulse<true>();
+template float Arbiter::ApplyJacobiImpulse<false>(float relaxation, VelocityDelta* delta1, VelocityDelta* delta2);
+template float Arbiter::ApplyJacobiImpulse<true>(float relaxation, VelocityDelta* delta1, VelocityDelta* delta2);
@@ -15,32 +15,70 @@ Body::Body()
 {
 	position.Set(0.0f, 0.0f);
 	rotation = 0.0f;
+	position0.Set(0.0f, 0.0f);
+	rotation0 = 0.0f;
 	velocity.Set(0.0f, 0.0f);
 	angularVelocity = 0.0f;
+	biasVelocity.Set(0.0f, 0.0f);
+	biasAngularVelocity = 0.0f;
 	force.Set(0.0f, 0.0f);
 	torque = 0.0f;
 	friction = 0.2f;
 
+	shape = BOX;
 	width.Set(1.0f, 1.0f);
+	boxPolygon.SetBox(width);
+	radius = 0.0f;
+	polygon = NULL;
+	chain = NULL;
+	compound = NULL;
 	mass = FLT_MAX;
 	invMass = 0.0f;
 	I = FLT_MAX;
 	invI = 0.0f;
+
+	bullet = false;
+	categoryBits = 0x0001;
+	maskBits = 0xFFFFFFFF;
+	groupIndex = 0;
+	index = -1;
+	depth = -1;
+	residual = 0.0f;
+	rotationMatrix = Mat22(Vec2(1.0f, 0.0f), Vec2(0.0f, 1.0f));
+	deltaRotation = Mat22(Vec2(1.0f, 0.0f), Vec2(0.0f, 1.0f));
 }
 
 void Body::Set(const Vec2& w, float m)
 {
 	position.Set(0.0f, 0.0f);
 	rotation = 0.0f;
+	position0.Set(0.0f, 0.0f);
+	rotation0 = 0.0f;
 	velocity.Set(0.0f, 0.0f);
 	angularVelocity = 0.0f;
+	biasVelocity.Set(0.0f, 0.0f);
+	biasAngularVelocity = 0.0f;
 	force.Set(0.0f, 0.0f);
 	torque = 0.0f;
 	friction = 0.2f;
+	residual = 0.0f;
+
+	categoryBits = 0x0001;
+	maskBits = 0xFFFFFFFF;
+	groupIndex = 0;
 
+	shape = BOX;
 	width = w;
+	boxPolygon.SetBox(w);
+	radius = 0.0f;
+	polygon = NULL;
+	chain = NULL;
+	compound = NULL;
 	mass = m;
 
+	rotationMatrix = Mat22(Vec2(1.0f, 0.0f), Vec2(0.0f, 1.0f));
+	deltaRotation = Mat22(Vec2(1.0f, 0.0f), Vec2(0.0f, 1.0f));
+
 	if (mass < FLT_MAX)
 	{
 		invMass = 1.0f / mass;
@@ -54,3 +92,296 @@ void Body::Set(const Vec2& w, float m)
 		invI = 0.0f;
 	}
 }
+
+void Body::SetCircle(float r, float m)
+{
+	Set(Vec2(2.0f * r, 2.0f * r), m);
+	shape = CIRCLE;
+	radius = r;
+
+	if (mass < FLT_MAX)
+	{
+		I = 0.5f * mass * radius * radius;
+		invI = 1.0f / I;
+	}
+}
+
+void Body::SetPolygon(const Polygon* p, float m)
+{
+	Set(Vec2(2.0f * p->radius, 2.0f * p->radius), m);
+	shape = POLYGON;
+	polygon = p;
+
+	if (mass < FLT_MAX)
+	{
+		I = mass * polygon->inertia;
+		invI = 1.0f / I;
+	}
+}
+
+void Body::SetChain(const Chain* c)
+{
+	// The half extents reach every vertex, so the bounding circle of the
+	// width covers the chain like it does the other shapes.
+	Vec2 h(0.0f, 0.0f);
+	for (int i = 0; i < (int)c->vertices.size(); ++i)
+	{
+		h = Max(h, Abs(c->vertices[i]));
+	}
+
+	Set(2.0f * h, FLT_MAX);
+	shape = CHAIN;
+	chain = c;
+}
+
+void Body::SetCompound(const Compound* c, float m)
+{
+	Set(Vec2(2.0f * c->radius, 2.0f * c->radius), m);
+	shape = COMPOUND;
+	compound = c;
+
+	if (mass < FLT_MAX)
+	{
+		I = mass * compound->inertia;
+		invI = 1.0f / I;
+	}
+}
+
+void Polygon::SetBox(const Vec2& w)
+{
+	Vec2 h = 0.5f * w;
+	count = 4;
+	vertices[0].Set(-h.x, -h.y);
+	vertices[1].Set( h.x, -h.y);
+	vertices[2].Set( h.x,  h.y);
+	vertices[3].Set(-h.x,  h.y);
+	normals[0].Set( 0.0f, -1.0f);
+	normals[1].Set( 1.0f,  0.0f);
+	normals[2].Set( 0.0f,  1.0f);
+	normals[3].Set(-1.0f,  0.0f);
+	inertia = (w.x * w.x + w.y * w.y) / 12.0f;
+	radius = h.Length();
+}
+
+void Polygon::Set(const Vec2* points, int n)
+{
+	assert(3 <= n && n <= MAX_VERTICES);
+	count = n;
+
+	// Sum over the triangles fanning out from the first point. Working
+	// relative to a point on the polygon keeps the products small.
+	Vec2 s = points[0];
+	float area = 0.0f;
+	Vec2 center(0.0f, 0.0f);
+	float I = 0.0f;
+
+	for (int i = 1; i < n - 1; ++i)
+	{
+		Vec2 e1 = points[i] - s;
+		Vec2 e2 = points[i + 1] - s;
+		float D = Cross(e1, e2);
+
+		float triangleArea = 0.5f * D;
+		area += triangleArea;
+		center += (triangleArea / 3.0f) * (e1 + e2);
+
+		float intx2 = e1.x * e1.x + e2.x * e1.x + e2.x * e2.x;
+		float inty2 = e1.y * e1.y + e2.y * e1.y + e2.y * e2.y;
+		I += (D / 12.0f) * (intx2 + inty2);
+	}
+
+	assert(area > 0.0f);
+	center *= 1.0f / area;
+
+	// Parallel axis theorem, from the first point to the centroid.
+	inertia = I / area - Dot(center, center);
+
+	Vec2 centroid = s + center;
+	radius = 0.0f;
+	for (int i = 0; i < n; ++i)
+	{
+		vertices[i] = points[i] - centroid;
+		radius = Max(radius, vertices[i].Length());
+	}
+
+	for (int i = 0; i < n; ++i)
+	{
+		Vec2 edge = vertices[i + 1 < n ? i + 1 : 0] - vertices[i];
+		assert(edge.Length() > FLT_EPSILON);
+		normals[i] = (1.0f / edge.Length()) * Vec2(edge.y, -edge.x);
+	}
+}
+
+void Chain::Set(const Vec2* points, int count, bool isLoop)
+{
+	assert(count >= 2 && (isLoop == false || count >= 3));
+	vertices.assign(points, points + count);
+	loop = isLoop;
+
+	int segmentCount = SegmentCount();
+	lower.resize(segmentCount);
+	upper.resize(segmentCount);
+
+	int runCount = (segmentCount + RUN_LENGTH - 1) / RUN_LENGTH;
+	runLower.assign(runCount, Vec2(FLT_MAX, FLT_MAX));
+	runUpper.assign(runCount, Vec2(-FLT_MAX, -FLT_MAX));
+
+	for (int i = 0; i < segmentCount; ++i)
+	{
+		const Vec2& v1 = Vertex(i);
+		const Vec2& v2 = Vertex(i + 1);
+		assert((v2 - v1).Length() > FLT_EPSILON);
+
+		lower[i] = Min(v1, v2);
+		upper[i] = Max(v1, v2);
+
+		int run = i / RUN_LENGTH;
+		runLower[run] = Min(runLower[run], lower[i]);
+		runUpper[run] = Max(runUpper[run], upper[i]);
+	}
+}
+
+static bool Overlap(const Vec2& lower1, const Vec2& upper1, const Vec2& lower2, const Vec2& upper2)
+{
+	return lower1.x <= upper2.x && lower2.x <= upper1.x && lower1.y <= upper2.y && lower2.y <= upper1.y;
+}
+
+void Chain::Query(std::vector<int>* segments, const Vec2& queryLower, const Vec2& queryUpper) const
+{
+	int segmentCount = SegmentCount();
+	for (int run = 0; run < (int)runLower.size(); ++run)
+	{
+		if (Overlap(runLower[run], runUpper[run], queryLower, queryUpper) == false)
+			continue;
+
+		int end = (run + 1) * RUN_LENGTH < segmentCount ? (run + 1) * RUN_LENGTH : segmentCount;
+		for (int i = run * RUN_LENGTH; i < end; ++i)
+		{
+			if (Overlap(lower[i], upper[i], queryLower, queryUpper))
+				segments->push_back(i);
+		}
+	}
+}
+
+// Builds the node over the children in indices and returns its index. The
+// children are split at the median center along the longer side.
+static int BuildNode(Compound* compound, int* indices, int count, const Vec2* lower, const Vec2* upper)
+{
+	int index = compound->nodeCount++;
+	Compound::Node* node = compound->nodes + index;
+
+	node->lower = lower[indices[0]];
+	node->upper = upper[indices[0]];
+	for (int i = 1; i < count; ++i)
+	{
+		node->lower = Min(node->lower, lower[indices[i]]);
+		node->upper = Max(node->upper, upper[indices[i]]);
+	}
+
+	if (count == 1)
+	{
+		node->node1 = -1;
+		node->node2 = -1;
+		node->child = indices[0];
+		return index;
+	}
+
+	Vec2 size = node->upper - node->lower;
+	bool xAxis = size.x >= size.y;
+
+	for (int i = 1; i < count; ++i)
+	{
+		for (int j = i; j > 0; --j)
+		{
+			const Vec2& c1 = compound->children[indices[j - 1]].position;
+			const Vec2& c2 = compound->children[indices[j]].position;
+			if ((xAxis ? c1.x : c1.y) <= (xAxis ? c2.x : c2.y))
+				break;
+			Swap(indices[j - 1], indices[j]);
+		}
+	}
+
+	int half = count / 2;
+	node->child = -1;
+	node->node1 = BuildNode(compound, indices, half, lower, upper);
+	node->node2 = BuildNode(compound, indices + half, count - half, lower, upper);
+	return index;
+}
+
+void Compound::Set(const Child* boxes, int n)
+{
+	assert(1 <= n && n <= MAX_CHILDREN);
+	count = n;
+
+	// Every box has the same density, so its share of the mass is its
+	// share of the area.
+	float area = 0.0f;
+	Vec2 center(0.0f, 0.0f);
+	for (int i = 0; i < n; ++i)
+	{
+		float a = boxes[i].width.x * boxes[i].width.y;
+		area += a;
+		center += a * boxes[i].position;
+	}
+
+	assert(area > 0.0f);
+	center *= 1.0f / area;
+
+	float I = 0.0f;
+	radius = 0.0f;
+	Vec2 lower[MAX_CHILDREN], upper[MAX_CHILDREN];
+	int indices[MAX_CHILDREN];
+
+	for (int i = 0; i < n; ++i)
+	{
+		Child* c = children + i;
+		c->position = boxes[i].position - center;
+		c->rotation = boxes[i].rotation;
+		c->width = boxes[i].width;
+		c->R = Mat22(c->rotation);
+		c->polygon.SetBox(c->width);
+
+		// Parallel axis theorem, from the center of the box.
+		Vec2 w = c->width;
+		float a = w.x * w.y;
+		I += a * ((w.x * w.x + w.y * w.y) / 12.0f + Dot(c->position, c->position));
+
+		Vec2 h = Abs(c->R) * (0.5f * w);
+		lower[i] = c->position - h;
+		upper[i] = c->position + h;
+		radius = Max(radius, c->position.Length() + 0.5f * w.Length());
+		indices[i] = i;
+	}
+
+	inertia = I / area;
+
+	nodeCount = 0;
+	BuildNode(this, indices, n, lower, upper);
+}
+
+int Compound::Query(int* result, const Vec2& queryLower, const Vec2& queryUpper) const
+{
+	int stack[2 * MAX_CHILDREN - 1];
+	int stackCount = 0;
+	int resultCount = 0;
+
+	stack[stackCount++] = 0;
+	while (stackCount > 0)
+	{
+		const Node& node = nodes[stack[--stackCount]];
+		if (Overlap(node.lower, node.upper, queryLower, queryUpper) == false)
+			continue;
+
+		if (node.child >= 0)
+		{
+			result[resultCount++] = node.child;
+		}
+		else
+		{
+			stack[stackCount++] = node.node2;
+			stack[stackCount++] = node.node1;
+		}
+	}
+
+	return resultCount;
+}
@@ -11,6 +11,7 @@
 
 #include "box2d-lite/Arbiter.h"
 #include "box2d-lite/Body.h"
+#include "box2d-lite/SimdUtils.h"
 
 // Box vertex and edge numbering:
 //
@@ -152,39 +153,17 @@ static void ComputeIncidentEdge(ClipVertex c[2], const Vec2& h, const Vec2& pos,
 	c[1].v = pos + Rot * c[1].v;
 }
 
-// The normal points from A to B
-int Collide(Contact* contacts, Body* bodyA, Body* bodyB)
+// Clips the boxes once the face separation tests found them overlapping.
+// dA and dB are the offset from A to B in the frames of A and B.
+static int ClipBoxes(Contact* contacts, Body* bodyA, Body* bodyB, const Mat22& RotA, const Mat22& RotB,
+					 const Vec2& dA, const Vec2& dB, const Vec2& faceA, const Vec2& faceB, float margin)
 {
-	// Setup
 	Vec2 hA = 0.5f * bodyA->width;
 	Vec2 hB = 0.5f * bodyB->width;
 
 	Vec2 posA = bodyA->position;
 	Vec2 posB = bodyB->position;
 
-	Mat22 RotA(bodyA->rotation), RotB(bodyB->rotation);
-
-	Mat22 RotAT = RotA.Transpose();
-	Mat22 RotBT = RotB.Transpose();
-
-	Vec2 dp = posB - posA;
-	Vec2 dA = RotAT * dp;
-	Vec2 dB = RotBT * dp;
-
-	Mat22 C = RotAT * RotB;
-	Mat22 absC = Abs(C);
-	Mat22 absCT = absC.Transpose();
-
-	// Box A faces
-	Vec2 faceA = Abs(dA) - hA - absC * hB;
-	if (faceA.x > 0.0f || faceA.y > 0.0f)
-		return 0;
-
-	// Box B faces
-	Vec2 faceB = Abs(dB) - absCT * hA - hB;
-	if (faceB.x > 0.0f || faceB.y > 0.0f)
-		return 0;
-
 	// Find best axis
 	Axis axis;
 	float separation;
@@ -312,7 +291,7 @@ int Collide(Contact* contacts, Body* bodyA, Body* bodyB)
 	{
 		float separation = Dot(frontNormal, clipPoints2[i].v) - front;
 
-		if (separation <= 0)
+		if (separation <= margin)
 		{
 			contacts[numContacts].separation = separation;
 			contacts[numContacts].normal = normal;
@@ -326,4 +305,813 @@ int Collide(Contact* contacts, Body* bodyA, Body* bodyB)
 	}
 
 	return numContacts;
-}
\ No newline at end of file
+}
+
+// The normal points from A to B
+static int CollideBoxes(Contact* contacts, Body* bodyA, Body* bodyB, float margin)
+{
+	// Setup
+	Vec2 hA = 0.5f * bodyA->width;
+	Vec2 hB = 0.5f * bodyB->width;
+
+	Vec2 posA = bodyA->position;
+	Vec2 posB = bodyB->position;
+
+	const Mat22& RotA = bodyA->rotationMatrix;
+	const Mat22& RotB = bodyB->rotationMatrix;
+
+	Mat22 RotAT = RotA.Transpose();
+	Mat22 RotBT = RotB.Transpose();
+
+	Vec2 dp = posB - posA;
+	Vec2 dA = RotAT * dp;
+	Vec2 dB = RotBT * dp;
+
+	Mat22 C = RotAT * RotB;
+	Mat22 absC = Abs(C);
+	Mat22 absCT = absC.Transpose();
+
+	// Box A faces
+	Vec2 faceA = Abs(dA) - hA - absC * hB;
+	if (faceA.x > margin || faceA.y > margin)
+		return 0;
+
+	// Box B faces
+	Vec2 faceB = Abs(dB) - absCT * hA - hB;
+	if (faceB.x > margin || faceB.y > margin)
+		return 0;
+
+	return ClipBoxes(contacts, bodyA, bodyB, RotA, RotB, dA, dB, faceA, faceB, margin);
+}
+
+// Circles touch at one point, on the surface of A.
+static int CollideCircles(Contact* contacts, Body* bodyA, Body* bodyB, float margin)
+{
+	Vec2 d = bodyB->position - bodyA->position;
+	float r = bodyA->radius + bodyB->radius;
+	float distSq = Dot(d, d);
+	if (distSq > (r + margin) * (r + margin))
+		return 0;
+
+	float dist = sqrtf(distSq);
+	Vec2 normal = dist > FLT_EPSILON ? (1.0f / dist) * d : Vec2(0.0f, 1.0f);
+
+	contacts[0].separation = dist - r;
+	contacts[0].normal = normal;
+	contacts[0].position = bodyA->position + bodyA->radius * normal;
+	contacts[0].feature.value = 0;
+	return 1;
+}
+
+// The contact point is the point of box A closest to the center of
+// circle B. If the center is inside the box it is pushed out through the
+// nearest face.
+static int CollideBoxCircle(Contact* contacts, Body* bodyA, Body* bodyB, float margin)
+{
+	Vec2 hA = 0.5f * bodyA->width;
+	const Mat22& RotA = bodyA->rotationMatrix;
+
+	// Center of B in the frame of A.
+	Vec2 d = RotA.Transpose() * (bodyB->position - bodyA->position);
+	Vec2 point(Clamp(d.x, -hA.x, hA.x), Clamp(d.y, -hA.y, hA.y));
+	Vec2 normal;
+	float separation;
+
+	if (point.x == d.x && point.y == d.y)
+	{
+		Vec2 depth = hA - Abs(d);
+		if (depth.x < depth.y)
+		{
+			normal.Set(Sign(d.x), 0.0f);
+			point.x = normal.x * hA.x;
+			separation = -depth.x - bodyB->radius;
+		}
+		else
+		{
+			normal.Set(0.0f, Sign(d.y));
+			point.y = normal.y * hA.y;
+			separation = -depth.y - bodyB->radius;
+		}
+	}
+	else
+	{
+		Vec2 v = d - point;
+		float dist = v.Length();
+		if (dist > bodyB->radius + margin)
+			return 0;
+
+		normal = (1.0f / dist) * v;
+		separation = dist - bodyB->radius;
+	}
+
+	contacts[0].separation = separation;
+	contacts[0].normal = RotA * normal;
+	contacts[0].position = bodyA->position + RotA * point;
+	contacts[0].feature.value = 0;
+	return 1;
+}
+
+static int CollideCircleBox(Contact* contacts, Body* bodyA, Body* bodyB, float margin)
+{
+	int numContacts = CollideBoxCircle(contacts, bodyB, bodyA, margin);
+	if (numContacts > 0)
+		contacts[0].normal = -contacts[0].normal;
+	return numContacts;
+}
+
+// A polygon placed in the world. Boxes use their Body::boxPolygon when
+// they meet a polygon.
+struct PolygonPose
+{
+	const Polygon* polygon;
+	Vec2 position;
+	Mat22 R;
+
+	Vec2 Vertex(int i) const { return position + R * polygon->vertices[i]; }
+	Vec2 Normal(int i) const { return R * polygon->normals[i]; }
+};
+
+static PolygonPose MakePose(const Body* body)
+{
+	PolygonPose pose;
+	pose.position = body->position;
+	pose.R = body->rotationMatrix;
+	pose.polygon = body->shape == Body::POLYGON ? body->polygon : &body->boxPolygon;
+	return pose;
+}
+
+// Polygon edge i has feature number i + 1, 0 being NO_EDGE.
+static char EdgeNumber(int i, int count)
+{
+	return char((i + count) % count + 1);
+}
+
+// The edge of A along which B is least deep, and that depth. Positive
+// means the polygons are separated.
+static float FindMaxSeparation(int* edge, const PolygonPose& A, const PolygonPose& B)
+{
+	int countA = A.polygon->count;
+	int countB = B.polygon->count;
+
+	// Work in the frame of B.
+	Mat22 RT = B.R.Transpose();
+	Mat22 C = RT * A.R;
+	Vec2 d = RT * (A.position - B.position);
+
+	int bestEdge = 0;
+	float maxSeparation = -FLT_MAX;
+	for (int i = 0; i < countA; ++i)
+	{
+		Vec2 n = C * A.polygon->normals[i];
+		Vec2 v = d + C * A.polygon->vertices[i];
+
+		float separation = FLT_MAX;
+		for (int j = 0; j < countB; ++j)
+		{
+			separation = Min(separation, Dot(n, B.polygon->vertices[j] - v));
+		}
+
+		if (separation > maxSeparation)
+		{
+			maxSeparation = separation;
+			bestEdge = i;
+		}
+	}
+
+	*edge = bestEdge;
+	return maxSeparation;
+}
+
+// The edge of the incident polygon most opposed to the reference normal,
+// numbered as the incident polygon ("2") of the feature pair.
+static void FindIncidentEdge(ClipVertex c[2], const PolygonPose& incident, const Vec2& normal)
+{
+	int count = incident.polygon->count;
+
+	int edge = 0;
+	float minDot = FLT_MAX;
+	for (int i = 0; i < count; ++i)
+	{
+		float dot = Dot(normal, incident.Normal(i));
+		if (dot < minDot)
+		{
+			minDot = dot;
+			edge = i;
+		}
+	}
+
+	int next = edge + 1 < count ? edge + 1 : 0;
+
+	c[0].v = incident.Vertex(edge);
+	c[0].fp.e.inEdge2 = EdgeNumber(edge - 1, count);
+	c[0].fp.e.outEdge2 = EdgeNumber(edge, count);
+
+	c[1].v = incident.Vertex(next);
+	c[1].fp.e.inEdge2 = EdgeNumber(edge, count);
+	c[1].fp.e.outEdge2 = EdgeNumber(next, count);
+}
+
+// The reference and incident face clipping of Collide, for any pair of
+// convex polygons. The normal points from A to B.
+static int CollidePolygons(Contact* contacts, const PolygonPose& A, const PolygonPose& B, float margin)
+{
+	int edgeA;
+	float separationA = FindMaxSeparation(&edgeA, A, B);
+	if (separationA > margin)
+		return 0;
+
+	int edgeB;
+	float separationB = FindMaxSeparation(&edgeB, B, A);
+	if (separationB > margin)
+		return 0;
+
+	// Prefer A as the reference, as Collide does, so the choice doesn't
+	// flip between frames when the separations are close.
+	const float relativeTol = 0.95f;
+	const float absoluteTol = 0.005f;
+
+	const PolygonPose* reference = &A;
+	const PolygonPose* incident = &B;
+	int edge = edgeA;
+	bool flip = false;
+
+	if (separationB > relativeTol * separationA + absoluteTol)
+	{
+		reference = &B;
+		incident = &A;
+		edge = edgeB;
+		flip = true;
+	}
+
+	int count = reference->polygon->count;
+	int next = edge + 1 < count ? edge + 1 : 0;
+
+	Vec2 v1 = reference->Vertex(edge);
+	Vec2 v2 = reference->Vertex(next);
+	Vec2 frontNormal = reference->Normal(edge);
+	float front = Dot(frontNormal, v1);
+
+	Vec2 sideNormal = v2 - v1;
+	sideNormal *= 1.0f / sideNormal.Length();
+	float negSide = -Dot(sideNormal, v1);
+	float posSide = Dot(sideNormal, v2);
+
+	ClipVertex incidentEdge[2];
+	FindIncidentEdge(incidentEdge, *incident, frontNormal);
+
+	// Clip to the side planes through the ends of the reference edge. They
+	// belong to the edges before and after it.
+	ClipVertex clipPoints1[2];
+	ClipVertex clipPoints2[2];
+	int np;
+
+	np = ClipSegmentToLine(clipPoints1, incidentEdge, -sideNormal, negSide, EdgeNumber(edge - 1, count));
+
+	if (np < 2)
+		return 0;
+
+	np = ClipSegmentToLine(clipPoints2, clipPoints1, sideNormal, posSide, EdgeNumber(next, count));
+
+	if (np < 2)
+		return 0;
+
+	Vec2 normal = flip ? -frontNormal : frontNormal;
+
+	int numContacts = 0;
+	for (int i = 0; i < 2; ++i)
+	{
+		float separation = Dot(frontNormal, clipPoints2[i].v) - front;
+
+		if (separation <= margin)
+		{
+			contacts[numContacts].separation = separation;
+			contacts[numContacts].normal = normal;
+			// slide contact point onto reference face (easy to cull)
+			contacts[numContacts].position = clipPoints2[i].v - separation * frontNormal;
+			contacts[numContacts].feature = clipPoints2[i].fp;
+			if (flip)
+				Flip(contacts[numContacts].feature);
+			++numContacts;
+		}
+	}
+
+	return numContacts;
+}
+
+// Boxes meeting polygons go through the polygon code.
+static int CollideWithPolygon(Contact* contacts, Body* bodyA, Body* bodyB, float margin)
+{
+	return CollidePolygons(contacts, MakePose(bodyA), MakePose(bodyB), margin);
+}
+
+// The contact point is on the polygon, at the point nearest to the center
+// of the circle, or on the face the center is deepest behind.
+static int CollidePolygonCircle(Contact* contacts, Body* bodyA, Body* bodyB, float margin)
+{
+	const Polygon* polygon = bodyA->polygon;
+	const Mat22& RotA = bodyA->rotationMatrix;
+	float radius = bodyB->radius;
+
+	// Center of B in the frame of A.
+	Vec2 c = RotA.Transpose() * (bodyB->position - bodyA->position);
+
+	int edge = 0;
+	float maxSeparation = -FLT_MAX;
+	for (int i = 0; i < polygon->count; ++i)
+	{
+		float s = Dot(polygon->normals[i], c - polygon->vertices[i]);
+		if (s > radius + margin)
+			return 0;
+
+		if (s > maxSeparation)
+		{
+			maxSeparation = s;
+			edge = i;
+		}
+	}
+
+	Vec2 v1 = polygon->vertices[edge];
+	Vec2 v2 = polygon->vertices[edge + 1 < polygon->count ? edge + 1 : 0];
+
+	Vec2 normal, point;
+	float separation;
+
+	if (maxSeparation > 0.0f && Dot(c - v1, v2 - v1) < 0.0f)
+	{
+		// Nearest to the first vertex.
+		Vec2 d = c - v1;
+		float dist = d.Length();
+		if (dist > radius + margin)
+			return 0;
+		normal = (1.0f / dist) * d;
+		point = v1;
+		separation = dist - radius;
+	}
+	else if (maxSeparation > 0.0f && Dot(c - v2, v1 - v2) < 0.0f)
+	{
+		// Nearest to the second vertex.
+		Vec2 d = c - v2;
+		float dist = d.Length();
+		if (dist > radius + margin)
+			return 0;
+		normal = (1.0f / dist) * d;
+		point = v2;
+		separation = dist - radius;
+	}
+	else
+	{
+		normal = polygon->normals[edge];
+		point = c - maxSeparation * normal;
+		separation = maxSeparation - radius;
+	}
+
+	contacts[0].separation = separation;
+	contacts[0].normal = RotA * normal;
+	contacts[0].position = bodyA->position + RotA * point;
+	contacts[0].feature.value = 0;
+	return 1;
+}
+
+static int CollideCirclePolygon(Contact* contacts, Body* bodyA, Body* bodyB, float margin)
+{
+	int numContacts = CollidePolygonCircle(contacts, bodyB, bodyA, margin);
+	if (numContacts > 0)
+		contacts[0].normal = -contacts[0].normal;
+	return numContacts;
+}
+
+// A chain segment placed in the world, with its ghost vertices.
+struct Segment
+{
+	Segment(const Body* body, int child)
+	{
+		const Chain* chain = body->chain;
+		const Mat22& R = body->rotationMatrix;
+
+		v1 = body->position + R * chain->Vertex(child);
+		v2 = body->position + R * chain->Vertex(child + 1);
+		hasV0 = chain->HasPrevious(child);
+		hasV3 = chain->HasNext(child);
+		v0 = hasV0 ? body->position + R * chain->Vertex(child - 1) : v1;
+		v3 = hasV3 ? body->position + R * chain->Vertex(child + 2) : v2;
+
+		length = (v2 - v1).Length();
+		tangent = (1.0f / length) * (v2 - v1);
+		normal = Cross(1.0f, tangent);
+	}
+
+	Vec2 v0, v1, v2, v3;
+	bool hasV0, hasV3;
+	float length;
+	Vec2 tangent, normal;
+};
+
+// The contact point is on the segment, at the point nearest to the center
+// of the circle. A shared vertex belongs to the segment that starts there.
+static int CollideSegmentCircle(Contact* contacts, const Segment& A, Body* bodyB, float margin)
+{
+	Vec2 c = bodyB->position;
+	float radius = bodyB->radius;
+
+	float offset = Dot(A.normal, c - A.v1);
+	if (offset < 0.0f || offset > radius + margin)
+		return 0;
+
+	float u = Dot(A.tangent, c - A.v1);
+
+	Vec2 point;
+	if (u <= 0.0f)
+	{
+		// Still alongside the previous segment, which takes it.
+		if (A.hasV0 && Dot(A.v1 - A.v0, c - A.v1) < 0.0f)
+			return 0;
+		point = A.v1;
+	}
+	else if (u >= A.length)
+	{
+		if (A.hasV3)
+			return 0;
+		point = A.v2;
+	}
+	else
+	{
+		contacts[0].separation = offset - radius;
+		contacts[0].normal = A.normal;
+		contacts[0].position = c - offset * A.normal;
+		contacts[0].feature.value = 0;
+		return 1;
+	}
+
+	Vec2 d = c - point;
+	float dist = d.Length();
+	if (dist > radius + margin)
+		return 0;
+
+	contacts[0].separation = dist - radius;
+	contacts[0].normal = dist > FLT_EPSILON ? (1.0f / dist) * d : A.normal;
+	contacts[0].position = point;
+	contacts[0].feature.value = 0;
+	return 1;
+}
+
+// Like CollidePolygons with the segment as a polygon that has one face. A
+// face of B is only used as the reference when its normal is one the
+// segment may push along at that end; otherwise the face of the segment
+// is used, or the neighbouring segment is left to handle the contact.
+static int CollideSegmentPolygon(Contact* contacts, const Segment& A, const PolygonPose& B, float margin)
+{
+	int countB = B.polygon->count;
+
+	// Nothing behind the segment collides with it.
+	if (Dot(A.normal, B.position - A.v1) < 0.0f)
+		return 0;
+
+	float separationA = FLT_MAX;
+	for (int i = 0; i < countB; ++i)
+	{
+		separationA = Min(separationA, Dot(A.normal, B.Vertex(i) - A.v1));
+	}
+
+	if (separationA > margin)
+		return 0;
+
+	int edgeB = 0;
+	float separationB = -FLT_MAX;
+	for (int i = 0; i < countB; ++i)
+	{
+		Vec2 n = B.Normal(i);
+		Vec2 v = B.Vertex(i);
+		float separation = Min(Dot(n, A.v1 - v), Dot(n, A.v2 - v));
+		if (separation > separationB)
+		{
+			separationB = separation;
+			edgeB = i;
+		}
+	}
+
+	if (separationB > margin)
+		return 0;
+
+	const float relativeTol = 0.95f;
+	const float absoluteTol = 0.005f;
+
+	// Sine of the angle a face normal of B may lean past the normal of the
+	// neighbouring segment.
+	const float sinTol = 0.1f;
+
+	bool flip = false;
+	if (separationB > relativeTol * separationA + absoluteTol)
+	{
+		flip = true;
+
+		// The normal from the segment to B.
+		Vec2 n = -B.Normal(edgeB);
+
+		if (Dot(n, A.tangent) <= 0.0f)
+		{
+			if (A.hasV0)
+			{
+				Vec2 e0 = A.v1 - A.v0;
+				Vec2 n0 = Cross(1.0f, (1.0f / e0.Length()) * e0);
+
+				if (Cross(e0, A.tangent) > 0.0f)
+					flip = false;
+				else if (Cross(n0, n) > sinTol)
+					return 0;
+			}
+		}
+		else
+		{
+			if (A.hasV3)
+			{
+				Vec2 e2 = A.v3 - A.v2;
+				Vec2 n2 = Cross(1.0f, (1.0f / e2.Length()) * e2);
+
+				if (Cross(A.tangent, e2) > 0.0f)
+					flip = false;
+				else if (Cross(n, n2) > sinTol)
+					return 0;
+			}
+		}
+	}
+
+	Vec2 frontNormal, sideNormal;
+	float front, negSide, posSide;
+	char negEdge, posEdge;
+	ClipVertex incidentEdge[2];
+
+	if (flip == false)
+	{
+		// The segment is the reference face, with edge numbers 1 and 2 for
+		// its ends.
+		frontNormal = A.normal;
+		front = Dot(frontNormal, A.v1);
+		sideNormal = A.tangent;
+		negSide = -Dot(sideNormal, A.v1);
+		posSide = Dot(sideNormal, A.v2);
+		negEdge = EDGE1;
+		posEdge = EDGE2;
+		FindIncidentEdge(incidentEdge, B, frontNormal);
+	}
+	else
+	{
+		int next = edgeB + 1 < countB ? edgeB + 1 : 0;
+		Vec2 v1 = B.Vertex(edgeB);
+		Vec2 v2 = B.Vertex(next);
+
+		frontNormal = B.Normal(edgeB);
+		front = Dot(frontNormal, v1);
+		sideNormal = v2 - v1;
+		sideNormal *= 1.0f / sideNormal.Length();
+		negSide = -Dot(sideNormal, v1);
+		posSide = Dot(sideNormal, v2);
+		negEdge = EdgeNumber(edgeB - 1, countB);
+		posEdge = EdgeNumber(next, countB);
+
+		incidentEdge[0].v = A.v2;
+		incidentEdge[0].fp.e.inEdge2 = EDGE2;
+		incidentEdge[1].v = A.v1;
+		incidentEdge[1].fp.e.inEdge2 = EDGE1;
+	}
+
+	ClipVertex clipPoints1[2];
+	ClipVertex clipPoints2[2];
+	int np;
+
+	np = ClipSegmentToLine(clipPoints1, incidentEdge, -sideNormal, negSide, negEdge);
+
+	if (np < 2)
+		return 0;
+
+	np = ClipSegmentToLine(clipPoints2, clipPoints1, sideNormal, posSide, posEdge);
+
+	if (np < 2)
+		return 0;
+
+	Vec2 normal = flip ? -frontNormal : frontNormal;
+
+	int numContacts = 0;
+	for (int i = 0; i < 2; ++i)
+	{
+		float separation = Dot(frontNormal, clipPoints2[i].v) - front;
+
+		if (separation <= margin)
+		{
+			contacts[numContacts].separation = separation;
+			contacts[numContacts].normal = normal;
+			// slide contact point onto reference face (easy to cull)
+			contacts[numContacts].position = clipPoints2[i].v - separation * frontNormal;
+			contacts[numContacts].feature = clipPoints2[i].fp;
+			if (flip)
+				Flip(contacts[numContacts].feature);
+			++numContacts;
+		}
+	}
+
+	return numContacts;
+}
+
+// The normal points from the chain to B.
+static int CollideChain(Contact* contacts, Body* chain, int child, Body* bodyB, float margin)
+{
+	Segment segment(chain, child);
+
+	if (bodyB->shape == Body::CIRCLE)
+		return CollideSegmentCircle(contacts, segment, bodyB, margin);
+
+	return CollideSegmentPolygon(contacts, segment, MakePose(bodyB), margin);
+}
+
+typedef int CollideFunction(Contact* contacts, Body* bodyA, Body* bodyB, float margin);
+
+// Indexed by the shapes of A and B, so the narrowphase makes no virtual
+// calls and no shape tests. Chains and compounds come last and are not in
+// the table, since their pairs also name a segment or a box.
+static CollideFunction* const s_collideFunctions[Body::CHAIN][Body::CHAIN] =
+{
+	{CollideBoxes, CollideBoxCircle, CollideWithPolygon},
+	{CollideCircleBox, CollideCircles, CollideCirclePolygon},
+	{CollideWithPolygon, CollidePolygonCircle, CollideWithPolygon},
+};
+
+// A box of a compound, placed in the world. The box routines only read the
+// pose and the width, so it goes through them like a body of its own.
+static void MakeChildBox(Body* box, const Body* body, int child)
+{
+	const Compound::Child& c = body->compound->children[child];
+	*box = *body;
+	box->shape = Body::BOX;
+	box->position = body->position + body->rotationMatrix * c.position;
+	box->rotationMatrix = body->rotationMatrix * c.R;
+	box->width = c.width;
+	box->boxPolygon = c.polygon;
+}
+
+static int CollideCompound(Contact* contacts, Body* bodyA, Body* bodyB, int childA, int childB, float margin)
+{
+	Body boxA, boxB;
+
+	if (bodyA->shape == Body::COMPOUND)
+	{
+		MakeChildBox(&boxA, bodyA, childA);
+		bodyA = &boxA;
+	}
+
+	if (bodyB->shape == Body::COMPOUND)
+	{
+		MakeChildBox(&boxB, bodyB, childB);
+		bodyB = &boxB;
+	}
+
+	return Collide(contacts, bodyA, bodyB, childA, childB, margin);
+}
+
+int Collide(Contact* contacts, Body* bodyA, Body* bodyB, int childA, int childB, float margin)
+{
+	if (bodyA->shape == Body::COMPOUND || bodyB->shape == Body::COMPOUND)
+		return CollideCompound(contacts, bodyA, bodyB, childA, childB, margin);
+
+	if (bodyA->shape == Body::CHAIN)
+		return CollideChain(contacts, bodyA, childA, bodyB, margin);
+
+	if (bodyB->shape == Body::CHAIN)
+	{
+		int numContacts = CollideChain(contacts, bodyB, childB, bodyA, margin);
+		for (int i = 0; i < numContacts; ++i)
+		{
+			contacts[i].normal = -contacts[i].normal;
+		}
+		return numContacts;
+	}
+
+	return s_collideFunctions[bodyA->shape][bodyB->shape](contacts, bodyA, bodyB, margin);
+}
+
+// A pair that passed the face separation tests, waiting to be clipped.
+struct BoxOverlap
+{
+	CollidePair* pair;
+	Vec2 dA, dB;
+	Vec2 faceA, faceB;
+};
+
+// The face separation tests of CollideBoxes for up to k_simdWidth pairs,
+// one pair per lane. The operations are those of CollideBoxes in the same order,
+// so both find the same overlaps and the same axes. The overlapping pairs
+// are appended to overlaps and their number is returned.
+static int TestFaces(BoxOverlap* overlaps, CollidePair* const* pairs, int count)
+{
+	float pAx[k_simdWidth], pAy[k_simdWidth], cA[k_simdWidth], sA[k_simdWidth], hAx[k_simdWidth], hAy[k_simdWidth];
+	float pBx[k_simdWidth], pBy[k_simdWidth], cB[k_simdWidth], sB[k_simdWidth], hBx[k_simdWidth], hBy[k_simdWidth];
+	float margin[k_simdWidth];
+
+	for (int i = 0; i < k_simdWidth; ++i)
+	{
+		// Unused lanes repeat the first pair and are ignored.
+		const CollidePair* pair = pairs[i < count ? i : 0];
+		const Body* bodyA = pair->body1;
+		const Body* bodyB = pair->body2;
+		const Mat22& RotA = bodyA->rotationMatrix;
+		const Mat22& RotB = bodyB->rotationMatrix;
+
+		pAx[i] = bodyA->position.x; pAy[i] = bodyA->position.y;
+		cA[i] = RotA.col1.x; sA[i] = RotA.col1.y;
+		hAx[i] = 0.5f * bodyA->width.x; hAy[i] = 0.5f * bodyA->width.y;
+
+		pBx[i] = bodyB->position.x; pBy[i] = bodyB->position.y;
+		cB[i] = RotB.col1.x; sB[i] = RotB.col1.y;
+		hBx[i] = 0.5f * bodyB->width.x; hBy[i] = 0.5f * bodyB->width.y;
+
+		margin[i] = pair->margin;
+	}
+
+	FloatW CA = LoadW(cA), SA = LoadW(sA), HAx = LoadW(hAx), HAy = LoadW(hAy);
+	FloatW CB = LoadW(cB), SB = LoadW(sB), HBx = LoadW(hBx), HBy = LoadW(hBy);
+
+	FloatW dpx = SubW(LoadW(pBx), LoadW(pAx));
+	FloatW dpy = SubW(LoadW(pBy), LoadW(pAy));
+
+	// dA = RotA^T * dp, dB = RotB^T * dp
+	FloatW dAx = AddW(MulW(CA, dpx), MulW(SA, dpy));
+	FloatW dAy = SubW(MulW(CA, dpy), MulW(SA, dpx));
+	FloatW dBx = AddW(MulW(CB, dpx), MulW(SB, dpy));
+	FloatW dBy = SubW(MulW(CB, dpy), MulW(SB, dpx));
+
+	// C = RotA^T * RotB is a rotation, so Abs(C) is symmetric with a on the
+	// diagonal and b off it.
+	FloatW a = AbsW(AddW(MulW(CA, CB), MulW(SA, SB)));
+	FloatW b = AbsW(SubW(MulW(CA, SB), MulW(SA, CB)));
+
+	FloatW faceAx = SubW(SubW(AbsW(dAx), HAx), AddW(MulW(a, HBx), MulW(b, HBy)));
+	FloatW faceAy = SubW(SubW(AbsW(dAy), HAy), AddW(MulW(b, HBx), MulW(a, HBy)));
+	FloatW faceBx = SubW(SubW(AbsW(dBx), AddW(MulW(a, HAx), MulW(b, HAy))), HBx);
+	FloatW faceBy = SubW(SubW(AbsW(dBy), AddW(MulW(b, HAx), MulW(a, HAy))), HBy);
+
+	FloatW M = LoadW(margin);
+	int separated = GreaterMaskW(faceAx, M) | GreaterMaskW(faceAy, M) | GreaterMaskW(faceBx, M) | GreaterMaskW(faceBy, M);
+
+	float dA[2][k_simdWidth], dB[2][k_simdWidth], faceA[2][k_simdWidth], faceB[2][k_simdWidth];
+	StoreW(dA[0], dAx); StoreW(dA[1], dAy);
+	StoreW(dB[0], dBx); StoreW(dB[1], dBy);
+	StoreW(faceA[0], faceAx); StoreW(faceA[1], faceAy);
+	StoreW(faceB[0], faceBx); StoreW(faceB[1], faceBy);
+
+	int overlapCount = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		pairs[i]->numContacts = 0;
+
+		if (separated & (1 << i))
+			continue;
+
+		BoxOverlap* overlap = overlaps + overlapCount++;
+		overlap->pair = pairs[i];
+		overlap->dA.Set(dA[0][i], dA[1][i]);
+		overlap->dB.Set(dB[0][i], dB[1][i]);
+		overlap->faceA.Set(faceA[0][i], faceA[1][i]);
+		overlap->faceB.Set(faceB[0][i], faceB[1][i]);
+	}
+
+	return overlapCount;
+}
+
+void CollidePairs(CollidePair* pairs, int count)
+{
+	// Most candidate pairs are far apart, so the tests run over a block of
+	// pairs first and only the few that overlap go on to be clipped. Pairs
+	// with a circle are cheap enough to collide directly.
+	const int k_blockSize = 64;
+	CollidePair* boxPairs[k_blockSize];
+	BoxOverlap overlaps[k_blockSize];
+
+	for (int begin = 0; begin < count; begin += k_blockSize)
+	{
+		int end = begin + k_blockSize < count ? begin + k_blockSize : count;
+
+		int boxCount = 0;
+		for (int i = begin; i < end; ++i)
+		{
+			CollidePair* pair = pairs + i;
+			if (pair->body1->shape == Body::BOX && pair->body2->shape == Body::BOX)
+				boxPairs[boxCount++] = pair;
+			else
+				pair->numContacts = Collide(pair->contacts, pair->body1, pair->body2, pair->child1, pair->child2, pair->margin);
+		}
+
+		int overlapCount = 0;
+		for (int i = 0; i < boxCount; i += k_simdWidth)
+		{
+			int n = boxCount - i < k_simdWidth ? boxCount - i : k_simdWidth;
+			overlapCount += TestFaces(overlaps + overlapCount, boxPairs + i, n);
+		}
+
+		for (int i = 0; i < overlapCount; ++i)
+		{
+			const BoxOverlap& overlap = overlaps[i];
+			CollidePair* pair = overlap.pair;
+			pair->numContacts = ClipBoxes(pair->contacts, pair->body1, pair->body2,
+				pair->body1->rotationMatrix, pair->body2->rotationMatrix,
+				overlap.dA, overlap.dB, overlap.faceA, overlap.faceB, pair->margin);
+		}
+	}
+}
@@ -0,0 +1,727 @@
+/*
+* Copyright (c) 2006-2009 Erin Catto http://www.gphysics.com
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee,
+* provided that the above copyright notice appear in all copies.
+* Erin Catto makes no representations about the suitability
+* of this software for any purpose.
+* It is provided "as is" without express or implied warranty.
+*/
+
+#include "box2d-lite/Island.h"
+#include "box2d-lite/Arbiter.h"
+#include "box2d-lite/Body.h"
+#include "box2d-lite/Joint.h"
+#include "box2d-lite/JointBatch.h"
+#include "box2d-lite/World.h"
+#include "box2d-lite/ThreadPool.h"
+
+#include <algorithm>
+#include <vector>
+
+// The soft step solver only reads the switches once per step, so it isn't
+// specialized.
+Island::SolveFunction Island::SelectSolve(const World& world)
+{
+	static const SolveFunction solvers[8] =
+	{
+		&Island::Solve<false, false, false>,
+		&Island::Solve<false, false, true>,
+		&Island::Solve<false, true, false>,
+		&Island::Solve<false, true, true>,
+		&Island::Solve<true, false, false>,
+		&Island::Solve<true, false, true>,
+		&Island::Solve<true, true, false>,
+		&Island::Solve<true, true, true>,
+	};
+
+	if (world.stepSettings.solverType == World::SOFT_STEP)
+		return &Island::SolveSoftStep;
+
+	return solvers[4 * world.stepSettings.accumulateImpulses + 2 * world.stepSettings.warmStarting + world.stepSettings.positionCorrection];
+}
+
+template <bool accumulate, bool warm, bool correct>
+void Island::Solve(const World& world, float dt)
+{
+	float inv_dt = dt > 0.0f ? 1.0f / dt : 0.0f;
+
+	// Integrate forces.
+	for (int i = 0; i < bodyCount; ++i)
+	{
+		Body* b = bodies[i];
+
+		b->velocity += dt * (world.gravity + b->invMass * b->force);
+		b->angularVelocity += dt * b->invI * b->torque;
+	}
+
+	// Perform pre-steps.
+	for (int i = 0; i < arbiterCount; ++i)
+	{
+		arbiters[i]->PreStep<accumulate, correct>(world, inv_dt);
+	}
+
+	for (int i = 0; i < jointCount; ++i)
+	{
+		joints[i]->PreStep<warm, correct>(world, inv_dt);
+	}
+
+	if (jointNodeCount > 0)
+	{
+		FactorJointTree();
+	}
+	else if (jointBatches != NULL)
+	{
+		jointBatchCount = BatchJoints(joints, jointCount, jointBatches);
+	}
+
+	int maxIterations = world.stepSettings.adaptiveIterations ? IterationBudget(world) : world.iterations;
+
+	// Perform iterations.
+	iterationsUsed = 0;
+	float residual;
+	if (world.stepSettings.solverType == World::JACOBI || world.stepSettings.solverType == World::MASS_SPLITTING)
+		residual = SolveJacobi<accumulate>(world, maxIterations);
+	else
+		residual = SolveSequential<accumulate>(world, maxIterations);
+
+	for (int i = 0; i < jointBatchCount; ++i)
+	{
+		jointBatches[i].Store();
+	}
+
+	if (world.stepSettings.shockPropagation && world.stepSettings.solverType == World::SEQUENTIAL_IMPULSE && depth > 0)
+	{
+		PropagateShock();
+		++iterationsUsed;
+	}
+
+	// Integrate Velocities
+	for (int i = 0; i < bodyCount; ++i)
+	{
+		Body* b = bodies[i];
+
+		b->position += dt * (b->velocity + b->biasVelocity);
+		b->rotation += dt * (b->angularVelocity + b->biasAngularVelocity);
+
+		b->biasVelocity.Set(0.0f, 0.0f);
+		b->biasAngularVelocity = 0.0f;
+
+		b->force.Set(0.0f, 0.0f);
+		b->torque = 0.0f;
+
+		b->residual = residual;
+	}
+
+	if (correct && world.stepSettings.positionSolver)
+	{
+		SolvePositions(world, dt);
+	}
+}
+
+// Position iterations after integration, which replace the Baumgarte bias
+// of the velocity solver. They stop once no contact overlaps by more than
+// the slop past its allowed penetration and no rigid joint is further apart.
+void Island::SolvePositions(const World& world, float dt)
+{
+	const float k_positionSlop = 0.005f;
+
+	// The split impulse pass is off under the position solver, so the
+	// bodies turned by their velocity alone this step.
+	for (int i = 0; i < bodyCount; ++i)
+	{
+		Body* b = bodies[i];
+		b->deltaRotation = Mat22(dt * b->angularVelocity);
+	}
+
+	for (int iteration = 0; iteration < world.positionIterations; ++iteration)
+	{
+		float error = 0.0f;
+
+		for (int j = 0; j < arbiterCount; ++j)
+		{
+			error = Max(error, arbiters[j]->SolvePosition());
+		}
+
+		for (int j = 0; j < jointCount; ++j)
+		{
+			error = Max(error, joints[j]->SolvePosition());
+		}
+
+		if (error <= k_positionSlop)
+			break;
+	}
+
+	for (int i = 0; i < bodyCount; ++i)
+	{
+		bodies[i]->deltaRotation = Mat22(Vec2(1.0f, 0.0f), Vec2(0.0f, 1.0f));
+	}
+}
+
+static int ContactDepth(const Arbiter* arbiter)
+{
+	int depth1 = arbiter->body1->depth, depth2 = arbiter->body2->depth;
+	return depth1 > depth2 ? depth1 : depth2;
+}
+
+struct ContactDepthLess
+{
+	bool operator () (const Arbiter* a, const Arbiter* b) const
+	{
+		return ContactDepth(a) < ContactDepth(b);
+	}
+};
+
+// Going up the stack, each body is frozen once every contact at or below
+// its level is solved. A body above then can't push it back down, so the
+// support of the ground reaches the top in a single pass, as described by
+// Guendelman et al. in "Nonconvex Rigid Bodies with Stacking".
+void Island::PropagateShock()
+{
+	std::stable_sort(arbiters, arbiters + arbiterCount, ContactDepthLess());
+
+	for (int i = 0; i < arbiterCount; ++i)
+	{
+		Arbiter* arbiter = arbiters[i];
+		Body* b1 = arbiter->body1;
+		Body* b2 = arbiter->body2;
+
+		Body* lower = NULL;
+		if (b1->depth < b2->depth)
+			lower = b1;
+		else if (b2->depth < b1->depth)
+			lower = b2;
+
+		if (lower != NULL && lower->invMass > 0.0f)
+		{
+			lower->invMass = 0.0f;
+			lower->invI = 0.0f;
+		}
+
+		arbiter->ApplyShockImpulse();
+	}
+
+	for (int i = 0; i < bodyCount; ++i)
+	{
+		Body* b = bodies[i];
+		b->invMass = 1.0f / b->mass;
+		b->invI = 1.0f / b->I;
+	}
+}
+
+// An impulse at the top of a stack needs about one pass per level to reach
+// the ground, so deep islands get more passes. Wide islands get a few more
+// for the sideways coupling, and islands that ended the last step far from
+// converged get half again.
+int Island::IterationBudget(const World& world) const
+{
+	const float k_residualSlop = 0.01f;	// m/s
+
+	int budget = world.minIterations + (depth > 0 ? depth : 0);
+
+	int log2 = 0;
+	for (int n = bodyCount; n > 1; n >>= 1)
+		++log2;
+	budget += log2 / 2;
+
+	float lastResidual = 0.0f;
+	for (int i = 0; i < bodyCount; ++i)
+		lastResidual = Max(lastResidual, bodies[i]->residual);
+
+	if (lastResidual > k_residualSlop)
+		budget += budget / 2;
+
+	if (budget > world.maxIterations)
+		budget = world.maxIterations;
+	if (budget < world.minIterations)
+		budget = world.minIterations;
+	return budget;
+}
+
+// Gauss-Seidel iterations, stopping early once no impulse changes the
+// relative velocities by more than the tolerance.
+template <bool accumulate>
+float Island::SolveSequential(const World& world, int maxIterations)
+{
+	float residual = 0.0f;
+	while (iterationsUsed < maxIterations)
+	{
+		if (regionCount > 0)
+		{
+			residual = SolveRegions<accumulate>(world);
+		}
+		else
+		{
+			residual = SolveContacts<accumulate>(world, 0, arbiterCount);
+
+			if (jointNodeCount > 0)
+			{
+				residual = Max(residual, SolveJointTree());
+			}
+			else if (jointBatchCount > 0)
+			{
+				for (int j = 0; j < jointBatchCount; ++j)
+				{
+					residual = Max(residual, jointBatches[j].ApplyImpulse());
+				}
+			}
+			else
+			{
+				residual = Max(residual, SolveJoints(0, jointCount));
+			}
+		}
+
+		++iterationsUsed;
+
+		if (residual <= world.velocityTolerance)
+			break;
+	}
+
+	return residual;
+}
+
+template <bool accumulate>
+float Island::SolveContacts(const World& world, int begin, int end)
+{
+	float residual = 0.0f;
+
+	for (int j = begin; j < end; ++j)
+	{
+		residual = Max(residual, arbiters[j]->ApplyImpulse<accumulate>());
+	}
+
+	// See Arbiter::PreStep for when the pseudo-velocity pass runs.
+	if (world.stepSettings.splitImpulse && world.stepSettings.positionSolver == false)
+	{
+		for (int j = begin; j < end; ++j)
+		{
+			residual = Max(residual, arbiters[j]->ApplyBiasImpulse<accumulate>());
+		}
+	}
+
+	return residual;
+}
+
+float Island::SolveJoints(int begin, int end)
+{
+	float residual = 0.0f;
+
+	for (int j = begin; j < end; ++j)
+	{
+		residual = Max(residual, joints[j]->ApplyImpulse());
+	}
+
+	return residual;
+}
+
+struct RegionContext
+{
+	Island* island;
+	const World* world;
+	float* residuals;
+};
+
+template <bool accumulate>
+static void SolveRegionTask(void* context, int index)
+{
+	RegionContext* task = (RegionContext*)context;
+	Island* island = task->island;
+
+	float residual = island->SolveContacts<accumulate>(*task->world, island->arbiterRegions[index], island->arbiterRegions[index + 1]);
+	residual = Max(residual, island->SolveJoints(island->jointRegions[index], island->jointRegions[index + 1]));
+	task->residuals[index] = residual;
+}
+
+// The regions share no bodies, so their interiors are solved concurrently,
+// each in its usual order. The constraints between regions follow on this
+// thread. Neither step depends on the thread count.
+template <bool accumulate>
+float Island::SolveRegions(const World& world)
+{
+	float residuals[MAX_REGIONS];
+	RegionContext context = {this, &world, residuals};
+
+	if (world.threadPool != NULL)
+	{
+		world.threadPool->ParallelFor(SolveRegionTask<accumulate>, &context, regionCount);
+	}
+	else
+	{
+		for (int i = 0; i < regionCount; ++i)
+			SolveRegionTask<accumulate>(&context, i);
+	}
+
+	float residual = 0.0f;
+	for (int i = 0; i < regionCount; ++i)
+		residual = Max(residual, residuals[i]);
+
+	residual = Max(residual, SolveContacts<accumulate>(world, arbiterRegions[regionCount], arbiterCount));
+	residual = Max(residual, SolveJoints(jointRegions[regionCount], jointCount));
+
+	return residual;
+}
+
+// Jacobian of a joint with respect to one of its bodies. The columns are
+// the body's linear and angular velocity, the rows are the two constraint
+// rows padded with a zero row.
+static Mat33 JointJacobian(const Joint* joint, const Body* body)
+{
+	if (body == joint->body2)
+		return Mat33(Vec3(1.0f, 0.0f, 0.0f), Vec3(0.0f, 1.0f, 0.0f), Vec3(-joint->r2.y, joint->r2.x, 0.0f));
+
+	return Mat33(Vec3(-1.0f, 0.0f, 0.0f), Vec3(0.0f, -1.0f, 0.0f), Vec3(joint->r1.y, -joint->r1.x, 0.0f));
+}
+
+// The joints are solved together from
+//
+// [M  J^T] [dv]   [0]
+// [J  -S ] [y ] = [c]
+//
+// where c is the velocity error of each joint, S its softness and the
+// impulse is -y. Each body and each joint is a node of a tree, so the
+// matrix factors as L * D * L^T without fill in, as shown by Baraff in
+// "Linear-Time Dynamics using Lagrange Multipliers".
+void Island::FactorJointTree()
+{
+	for (int n = 0; n < jointNodeCount; ++n)
+	{
+		JointNode* node = jointNodes + n;
+		if (node->body != NULL)
+		{
+			Body* b = node->body;
+			node->D = Mat33(Vec3(b->mass, 0.0f, 0.0f), Vec3(0.0f, b->mass, 0.0f), Vec3(0.0f, 0.0f, b->I));
+		}
+		else
+		{
+			float s = node->joint->softness;
+			node->D = Mat33(Vec3(-s, 0.0f, 0.0f), Vec3(0.0f, -s, 0.0f), Vec3(0.0f, 0.0f, 1.0f));
+		}
+	}
+
+	for (int n = jointNodeCount - 1; n >= 0; --n)
+	{
+		JointNode* node = jointNodes + n;
+		node->D = node->D.Invert();
+
+		if (node->parent == -1)
+			continue;
+
+		JointNode* parent = jointNodes + node->parent;
+		Mat33 H = node->body != NULL ? JointJacobian(parent->joint, node->body).Transpose() : JointJacobian(node->joint, parent->body);
+		node->J = node->D * H;
+		parent->D = parent->D - H.Transpose() * node->J;
+	}
+}
+
+float Island::SolveJointTree()
+{
+	float residual = 0.0f;
+
+	for (int n = 0; n < jointNodeCount; ++n)
+	{
+		JointNode* node = jointNodes + n;
+		if (node->body != NULL)
+		{
+			node->x.Set(0.0f, 0.0f, 0.0f);
+			continue;
+		}
+
+		Joint* j = node->joint;
+		Vec2 dv = j->body2->velocity + Cross(j->body2->angularVelocity, j->r2) - j->body1->velocity - Cross(j->body1->angularVelocity, j->r1);
+		Vec2 error = j->bias - dv - j->softness * j->P;
+		node->x.Set(error.x, error.y, 0.0f);
+
+		residual = Max(residual, Max(Abs(error.x), Abs(error.y)));
+	}
+
+	for (int n = jointNodeCount - 1; n >= 0; --n)
+	{
+		JointNode* node = jointNodes + n;
+		if (node->parent != -1)
+			jointNodes[node->parent].x -= node->J.Transpose() * node->x;
+	}
+
+	for (int n = 0; n < jointNodeCount; ++n)
+	{
+		JointNode* node = jointNodes + n;
+		node->x = node->D * node->x;
+
+		if (node->parent != -1)
+			node->x -= node->J * jointNodes[node->parent].x;
+	}
+
+	for (int n = 0; n < jointNodeCount; ++n)
+	{
+		JointNode* node = jointNodes + n;
+		if (node->body != NULL)
+		{
+			node->body->velocity += Vec2(node->x.x, node->x.y);
+			node->body->angularVelocity += node->x.z;
+		}
+		else
+		{
+			node->joint->P -= Vec2(node->x.x, node->x.y);
+		}
+	}
+
+	return residual;
+}
+
+struct JacobiContext
+{
+	Island* island;
+	float relaxation;
+	bool average;
+	float* residuals;
+};
+
+template <bool accumulate>
+static void JacobiConstraintTask(void* context, int index)
+{
+	JacobiContext* task = (JacobiContext*)context;
+	Island* island = task->island;
+
+	int begin = index * Island::JACOBI_BATCH_SIZE;
+	int end = begin + Island::JACOBI_BATCH_SIZE;
+	int constraintCount = island->arbiterCount + island->jointCount;
+	if (end > constraintCount)
+		end = constraintCount;
+
+	float residual = 0.0f;
+	for (int k = begin; k < end; ++k)
+	{
+		VelocityDelta* delta = island->deltas + 2 * k;
+		if (k < island->arbiterCount)
+			residual = Max(residual, island->arbiters[k]->ApplyJacobiImpulse<accumulate>(task->relaxation, delta, delta + 1));
+		else
+			residual = Max(residual, island->joints[k - island->arbiterCount]->ApplyJacobiImpulse(task->relaxation, delta, delta + 1));
+	}
+
+	task->residuals[index] = residual;
+}
+
+static void JacobiBodyTask(void* context, int index)
+{
+	JacobiContext* task = (JacobiContext*)context;
+	Island* island = task->island;
+
+	int begin = index * Island::JACOBI_BATCH_SIZE;
+	int end = begin + Island::JACOBI_BATCH_SIZE;
+	if (end > island->bodyCount)
+		end = island->bodyCount;
+
+	for (int i = begin; i < end; ++i)
+	{
+		Body* b = island->bodies[i];
+		int first = island->deltaOffsets[b->index];
+		int last = island->deltaOffsets[b->index + 1];
+		if (first == last)
+			continue;
+
+		Vec2 dv(0.0f, 0.0f);
+		float dw = 0.0f;
+
+		for (int k = first; k < last; ++k)
+		{
+			const VelocityDelta& delta = island->deltas[island->deltaSlots[k]];
+			dv += delta.v;
+			dw += delta.w;
+		}
+
+		if (task->average)
+		{
+			float scale = 1.0f / float(last - first);
+			dv *= scale;
+			dw *= scale;
+		}
+
+		b->velocity += dv;
+		b->angularVelocity += dw;
+	}
+}
+
+// Every constraint solves against the velocities of the last iteration,
+// then each body adds up the changes asked of it. Both passes are free of
+// conflicts, so they run on the thread pool, and the sums are taken in a
+// fixed order so the result doesn't depend on the number of threads.
+//
+// With mass splitting, a body with n constraints gives each of them a copy
+// with 1/n of its mass, and its velocity becomes the average of the copies.
+// That averages to the full impulse on the full mass, so no relaxation is
+// needed however many constraints share a body. Static bodies are never
+// split, so a ground touched by everything costs nothing extra.
+template <bool accumulate>
+float Island::SolveJacobi(const World& world, int maxIterations)
+{
+	int constraintCount = arbiterCount + jointCount;
+	int constraintBatches = (constraintCount + JACOBI_BATCH_SIZE - 1) / JACOBI_BATCH_SIZE;
+	int bodyBatches = (bodyCount + JACOBI_BATCH_SIZE - 1) / JACOBI_BATCH_SIZE;
+
+	bool splitMass = world.stepSettings.solverType == World::MASS_SPLITTING;
+	if (splitMass)
+		SplitMasses(true);
+
+	JacobiContext context = {this, splitMass ? 1.0f : world.jacobiRelaxation, splitMass, residuals};
+
+	float residual = 0.0f;
+	while (iterationsUsed < maxIterations)
+	{
+		if (world.threadPool != NULL)
+		{
+			world.threadPool->ParallelFor(JacobiConstraintTask<accumulate>, &context, constraintBatches);
+			world.threadPool->ParallelFor(JacobiBodyTask, &context, bodyBatches);
+		}
+		else
+		{
+			for (int i = 0; i < constraintBatches; ++i)
+				JacobiConstraintTask<accumulate>(&context, i);
+			for (int i = 0; i < bodyBatches; ++i)
+				JacobiBodyTask(&context, i);
+		}
+
+		residual = 0.0f;
+		for (int i = 0; i < constraintBatches; ++i)
+			residual = Max(residual, residuals[i]);
+
+		++iterationsUsed;
+
+		if (residual <= world.velocityTolerance)
+			break;
+	}
+
+	if (splitMass)
+		SplitMasses(false);
+
+	return residual;
+}
+
+// Divides the mass of each body among its constraints, or restores it, and
+// rebuilds the constraint masses to match. Warm starting has already been
+// done with the full masses.
+void Island::SplitMasses(bool split)
+{
+	for (int i = 0; i < bodyCount; ++i)
+	{
+		Body* b = bodies[i];
+		int count = deltaOffsets[b->index + 1] - deltaOffsets[b->index];
+		float scale = split && count > 1 ? float(count) : 1.0f;
+		b->invMass = scale / b->mass;
+		b->invI = scale / b->I;
+	}
+
+	if (split == false)
+		return;
+
+	for (int i = 0; i < arbiterCount; ++i)
+	{
+		arbiters[i]->UpdateMass();
+	}
+
+	for (int i = 0; i < jointCount; ++i)
+	{
+		joints[i]->UpdateMass();
+	}
+}
+
+// Splits the step into substeps. Each substep integrates velocities, warm
+// starts, runs one biased iteration with soft constraints, integrates
+// positions, then runs one relax iteration without bias to remove the
+// velocity the soft constraints added.
+void Island::SolveSoftStep(const World& world, float dt)
+{
+	// Contacts can't be stiffer than the substep resolves. Joints may be
+	// stiffer since they don't have to handle large overlap.
+	const float k_contactHertz = 60.0f;
+	const float k_contactDampingRatio = 10.0f;
+	const float k_jointHertz = 60.0f;
+	const float k_jointDampingRatio = 2.0f;
+
+	int subSteps = world.subSteps > 0 ? world.subSteps : 1;
+	float h = dt / subSteps;
+	float inv_h = h > 0.0f ? 1.0f / h : 0.0f;
+
+	Softness contactSoftness = MakeSoft(Min(k_contactHertz, 0.25f * inv_h), k_contactDampingRatio, h);
+	Softness jointSoftness = MakeSoft(Min(k_jointHertz, 0.5f * inv_h), k_jointDampingRatio, h);
+	bool useBias = world.stepSettings.positionCorrection;
+
+	for (int i = 0; i < bodyCount; ++i)
+	{
+		bodies[i]->deltaRotation = Mat22(Vec2(1.0f, 0.0f), Vec2(0.0f, 1.0f));
+	}
+
+	for (int i = 0; i < arbiterCount; ++i)
+	{
+		arbiters[i]->PrepareSoft();
+	}
+
+	for (int i = 0; i < jointCount; ++i)
+	{
+		joints[i]->PrepareSoft(world, dt, h);
+	}
+
+	for (int step = 0; step < subSteps; ++step)
+	{
+		// Integrate forces.
+		for (int i = 0; i < bodyCount; ++i)
+		{
+			Body* b = bodies[i];
+
+			b->velocity += h * (world.gravity + b->invMass * b->force);
+			b->angularVelocity += h * b->invI * b->torque;
+		}
+
+		// Apply the impulses accumulated so far. Settings::warmStarting only
+		// decides whether they carry over from the last step.
+		for (int i = 0; i < arbiterCount; ++i)
+		{
+			arbiters[i]->WarmStart();
+		}
+
+		for (int i = 0; i < jointCount; ++i)
+		{
+			joints[i]->WarmStart();
+		}
+
+		for (int i = 0; i < arbiterCount; ++i)
+		{
+			arbiters[i]->SolveSoft(contactSoftness, inv_h, useBias);
+		}
+
+		for (int i = 0; i < jointCount; ++i)
+		{
+			joints[i]->SolveSoft(jointSoftness, useBias);
+		}
+
+		// Integrate velocities.
+		for (int i = 0; i < bodyCount; ++i)
+		{
+			Body* b = bodies[i];
+
+			b->position += h * b->velocity;
+			b->rotation += h * b->angularVelocity;
+			b->deltaRotation = Mat22(h * b->angularVelocity) * b->deltaRotation;
+		}
+
+		// Relax.
+		for (int i = 0; i < arbiterCount; ++i)
+		{
+			arbiters[i]->SolveSoft(contactSoftness, inv_h, false);
+		}
+
+		for (int i = 0; i < jointCount; ++i)
+		{
+			joints[i]->SolveSoft(jointSoftness, false);
+		}
+	}
+
+	for (int i = 0; i < bodyCount; ++i)
+	{
+		Body* b = bodies[i];
+
+		b->force.Set(0.0f, 0.0f);
+		b->torque = 0.0f;
+	}
+
+	iterationsUsed = subSteps;
+}
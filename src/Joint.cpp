@@ -32,19 +32,12 @@ void Joint::Set(Body* b1, Body* b2, const Vec2& anchor)
 	biasFactor = 0.2f;
 }
 
-void Joint::PreStep(float inv_dt)
+// deltaV = deltaV0 + K * impulse
+// invM = [(1/m1 + 1/m2) * eye(2) - skew(r1) * invI1 * skew(r1) - skew(r2) * invI2 * skew(r2)]
+//      = [1/m1+1/m2     0    ] + invI1 * [r1.y*r1.y -r1.x*r1.y] + invI2 * [r1.y*r1.y -r1.x*r1.y]
+//        [    0     1/m1+1/m2]           [-r1.x*r1.y r1.x*r1.x]           [-r1.x*r1.y r1.x*r1.x]
+static Mat22 ComputeK(const Body* body1, const Body* body2, const Vec2& r1, const Vec2& r2)
 {
-	// Pre-compute anchors, mass matrix, and bias.
-	Mat22 Rot1(body1->rotation);
-	Mat22 Rot2(body2->rotation);
-
-	r1 = Rot1 * localAnchor1;
-	r2 = Rot2 * localAnchor2;
-
-	// deltaV = deltaV0 + K * impulse
-	// invM = [(1/m1 + 1/m2) * eye(2) - skew(r1) * invI1 * skew(r1) - skew(r2) * invI2 * skew(r2)]
-	//      = [1/m1+1/m2     0    ] + invI1 * [r1.y*r1.y -r1.x*r1.y] + invI2 * [r1.y*r1.y -r1.x*r1.y]
-	//        [    0     1/m1+1/m2]           [-r1.x*r1.y r1.x*r1.x]           [-r1.x*r1.y r1.x*r1.x]
 	Mat22 K1;
 	K1.col1.x = body1->invMass + body2->invMass;	K1.col2.x = 0.0f;
 	K1.col1.y = 0.0f;								K1.col2.y = body1->invMass + body2->invMass;
@@ -57,7 +50,20 @@ void Joint::PreStep(float inv_dt)
 	K3.col1.x =  body2->invI * r2.y * r2.y;		K3.col2.x = -body2->invI * r2.x * r2.y;
 	K3.col1.y = -body2->invI * r2.x * r2.y;		K3.col2.y =  body2->invI * r2.x * r2.x;
 
-	Mat22 K = K1 + K2 + K3;
+	return K1 + K2 + K3;
+}
+
+template <bool warm, bool correct>
+void Joint::PreStep(const World& world, float inv_dt)
+{
+	// Pre-compute anchors, mass matrix, and bias.
+	const Mat22& Rot1 = body1->rotationMatrix;
+	const Mat22& Rot2 = body2->rotationMatrix;
+
+	r1 = Rot1 * localAnchor1;
+	r2 = Rot2 * localAnchor2;
+
+	Mat22 K = ComputeK(body1, body2, r1, r2);
 	K.col1.x += softness;
 	K.col2.y += softness;
 
@@ -67,7 +73,8 @@ void Joint::PreStep(float inv_dt)
 	Vec2 p2 = body2->position + r2;
 	Vec2 dp = p2 - p1;
 
-	if (World::positionCorrection)
+	// Springs keep their bias, it is part of the spring.
+	if (correct && (world.stepSettings.positionSolver == false || softness > 0.0f))
 	{
 		bias = -biasFactor * inv_dt * dp;
 	}
@@ -76,14 +83,11 @@ void Joint::PreStep(float inv_dt)
 		bias.Set(0.0f, 0.0f);
 	}
 
-	if (World::warmStarting)
+	if (warm)
 	{
 		// Apply accumulated impulse.
-		body1->velocity -= body1->invMass * P;
-		body1->angularVelocity -= body1->invI * Cross(r1, P);
-
-		body2->velocity += body2->invMass * P;
-		body2->angularVelocity += body2->invI * Cross(r2, P);
+		body1->StoreVelocity(body1->velocity - body1->invMass * P, body1->angularVelocity - body1->invI * Cross(r1, P));
+		body2->StoreVelocity(body2->velocity + body2->invMass * P, body2->angularVelocity + body2->invI * Cross(r2, P));
 	}
 	else
 	{
@@ -91,19 +95,151 @@ void Joint::PreStep(float inv_dt)
 	}
 }
 
-void Joint::ApplyImpulse()
+void Joint::UpdateMass()
+{
+	Mat22 K = ComputeK(body1, body2, r1, r2);
+	K.col1.x += softness;
+	K.col2.y += softness;
+
+	M = K.Invert();
+}
+
+float Joint::ApplyImpulse()
 {
     Vec2 dv = body2->velocity + Cross(body2->angularVelocity, r2) - body1->velocity - Cross(body1->angularVelocity, r1);
 
+	Vec2 error = bias - dv - softness * P;
+
 	Vec2 impulse;
 
-	impulse = M * (bias - dv - softness * P);
+	impulse = M * error;
+
+	body1->StoreVelocity(body1->velocity - body1->invMass * impulse, body1->angularVelocity - body1->invI * Cross(r1, impulse));
+	body2->StoreVelocity(body2->velocity + body2->invMass * impulse, body2->angularVelocity + body2->invI * Cross(r2, impulse));
+
+	P += impulse;
+
+	return Max(Abs(error.x), Abs(error.y));
+}
+
+float Joint::ApplyJacobiImpulse(float relaxation, VelocityDelta* delta1, VelocityDelta* delta2)
+{
+	Vec2 dv = body2->velocity + Cross(body2->angularVelocity, r2) - body1->velocity - Cross(body1->angularVelocity, r1);
+
+	Vec2 error = bias - dv - softness * P;
+
+	Vec2 impulse = relaxation * (M * error);
+
+	delta1->v = -body1->invMass * impulse;
+	delta1->w = -body1->invI * Cross(r1, impulse);
+	delta2->v = body2->invMass * impulse;
+	delta2->w = body2->invI * Cross(r2, impulse);
+
+	P += impulse;
+
+	return Max(Abs(error.x), Abs(error.y));
+}
+
+// Moves the anchors together along the shortest path for the current
+// rotations. Springs are left to their bias.
+float Joint::SolvePosition()
+{
+	if (softness > 0.0f)
+		return 0.0f;
+
+	Mat22 Rot1(body1->rotation);
+	Mat22 Rot2(body2->rotation);
+
+	Vec2 rA = Rot1 * localAnchor1;
+	Vec2 rB = Rot2 * localAnchor2;
 
-	body1->velocity -= body1->invMass * impulse;
-	body1->angularVelocity -= body1->invI * Cross(r1, impulse);
+	Vec2 C = body2->position + rB - body1->position - rA;
 
-	body2->velocity += body2->invMass * impulse;
-	body2->angularVelocity += body2->invI * Cross(r2, impulse);
+	Mat22 K = ComputeK(body1, body2, rA, rB);
+	Vec2 impulse = K.Invert() * C;
+
+	body1->CorrectPosition(body1->invMass * impulse, body1->invI * Cross(rA, impulse));
+	body2->CorrectPosition(-body2->invMass * impulse, -body2->invI * Cross(rB, impulse));
+
+	return C.Length();
+}
+
+void Joint::PrepareSoft(const World& world, float dt, float h)
+{
+	const Mat22& Rot1 = body1->rotationMatrix;
+	const Mat22& Rot2 = body2->rotationMatrix;
+
+	r1 = Rot1 * localAnchor1;
+	r2 = Rot2 * localAnchor2;
+
+	stepSoftness = 0.0f;
+	stepBiasRate = 0.0f;
+
+	if (softness > 0.0f)
+	{
+		// softness = 1 / (d + dt * k) and biasFactor = dt * k / (d + dt * k)
+		// for a damper d and a spring k tuned at dt. Recover the spring and
+		// damper in these units and rebuild both for the substep h.
+		float ratio = h / dt;
+		float denominator = (1.0f - biasFactor) + biasFactor * ratio;
+		stepSoftness = softness / denominator;
+
+		if (world.stepSettings.positionCorrection)
+			stepBiasRate = biasFactor * ratio / (denominator * h);
+	}
+
+	Mat22 K = ComputeK(body1, body2, r1, r2);
+	K.col1.x += stepSoftness;
+	K.col2.y += stepSoftness;
+
+	M = K.Invert();
+
+	if (world.stepSettings.warmStarting == false)
+	{
+		P.Set(0.0f, 0.0f);
+	}
+}
+
+void Joint::WarmStart()
+{
+	Vec2 rA = body1->deltaRotation * r1;
+	Vec2 rB = body2->deltaRotation * r2;
+
+	body1->StoreVelocity(body1->velocity - body1->invMass * P, body1->angularVelocity - body1->invI * Cross(rA, P));
+	body2->StoreVelocity(body2->velocity + body2->invMass * P, body2->angularVelocity + body2->invI * Cross(rB, P));
+}
+
+void Joint::SolveSoft(const Softness& jointSoftness, bool useBias)
+{
+	// Anchors follow the bodies through the substeps.
+	Vec2 rA = body1->deltaRotation * r1;
+	Vec2 rB = body2->deltaRotation * r2;
+
+	Vec2 dv = body2->velocity + Cross(body2->angularVelocity, rB) - body1->velocity - Cross(body1->angularVelocity, rA);
+	Vec2 C = body2->position + rB - body1->position - rA;
+
+	Vec2 impulse;
+	if (softness > 0.0f)
+	{
+		// User springs stay soft in the relax pass too.
+		impulse = M * (-stepBiasRate * C - dv - stepSoftness * P);
+	}
+	else if (useBias)
+	{
+		impulse = -jointSoftness.massScale * (M * (dv + jointSoftness.biasRate * C)) - jointSoftness.impulseScale * P;
+	}
+	else
+	{
+		impulse = -(M * dv);
+	}
+
+	body1->StoreVelocity(body1->velocity - body1->invMass * impulse, body1->angularVelocity - body1->invI * Cross(rA, impulse));
+	body2->StoreVelocity(body2->velocity + body2->invMass * impulse, body2->angularVelocity + body2->invI * Cross(rB, impulse));
 
 	P += impulse;
 }
+
+template void Joint::PreStep<false, false>(const World& world, float inv_dt);
+template void Joint::PreStep<false, true>(const World& world, float inv_dt);
+template void Joint::PreStep<true, false>(const World& world, float inv_dt);
+template void Joint::PreStep<true, true>(const World& world, float inv_dt);
@@ -0,0 +1,159 @@
+/*
+* Copyright (c) 2006-2009 Erin Catto http://www.gphysics.com
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee,
+* provided that the above copyright notice appear in all copies.
+* Erin Catto makes no representations about the suitability
+* of this software for any purpose.
+* It is provided "as is" without express or implied warranty.
+*/
+
+#include "box2d-lite/JointBatch.h"
+#include "box2d-lite/Body.h"
+#include "box2d-lite/Joint.h"
+#include "box2d-lite/SimdUtils.h"
+
+#include <string.h>
+
+// A batch is solved with one FloatW per field.
+static_assert(JointBatch::WIDTH == k_simdWidth, "JointBatch::WIDTH must match FloatW");
+
+bool JointBatch::CanAdd(const Joint* joint) const
+{
+	if (count == WIDTH)
+		return false;
+
+	// Static bodies may be shared, they are never written.
+	for (int i = 0; i < count; ++i)
+	{
+		if (joint->body1->invMass > 0.0f && (joint->body1 == body1[i] || joint->body1 == body2[i]))
+			return false;
+		if (joint->body2->invMass > 0.0f && (joint->body2 == body1[i] || joint->body2 == body2[i]))
+			return false;
+	}
+
+	return true;
+}
+
+void JointBatch::Add(Joint* joint)
+{
+	int i = count++;
+	joints[i] = joint;
+	body1[i] = joint->body1;
+	body2[i] = joint->body2;
+
+	m11[i] = joint->M.col1.x; m12[i] = joint->M.col2.x;
+	m21[i] = joint->M.col1.y; m22[i] = joint->M.col2.y;
+	r1x[i] = joint->r1.x; r1y[i] = joint->r1.y;
+	r2x[i] = joint->r2.x; r2y[i] = joint->r2.y;
+	biasX[i] = joint->bias.x; biasY[i] = joint->bias.y;
+	Px[i] = joint->P.x; Py[i] = joint->P.y;
+	softness[i] = joint->softness;
+	invMass1[i] = joint->body1->invMass; invI1[i] = joint->body1->invI;
+	invMass2[i] = joint->body2->invMass; invI2[i] = joint->body2->invI;
+}
+
+void JointBatch::Store()
+{
+	for (int i = 0; i < count; ++i)
+	{
+		joints[i]->P.Set(Px[i], Py[i]);
+	}
+}
+
+// Same as Joint::ApplyImpulse, one joint per lane. Unused lanes are zero
+// and stay zero.
+float JointBatch::ApplyImpulse()
+{
+	float v1x[WIDTH], v1y[WIDTH], w1[WIDTH];
+	float v2x[WIDTH], v2y[WIDTH], w2[WIDTH];
+
+	for (int i = 0; i < WIDTH; ++i)
+	{
+		if (i < count)
+		{
+			v1x[i] = body1[i]->velocity.x; v1y[i] = body1[i]->velocity.y; w1[i] = body1[i]->angularVelocity;
+			v2x[i] = body2[i]->velocity.x; v2y[i] = body2[i]->velocity.y; w2[i] = body2[i]->angularVelocity;
+		}
+		else
+		{
+			v1x[i] = 0.0f; v1y[i] = 0.0f; w1[i] = 0.0f;
+			v2x[i] = 0.0f; v2y[i] = 0.0f; w2[i] = 0.0f;
+		}
+	}
+
+	FloatW V1x = LoadW(v1x), V1y = LoadW(v1y), W1 = LoadW(w1);
+	FloatW V2x = LoadW(v2x), V2y = LoadW(v2y), W2 = LoadW(w2);
+	FloatW R1x = LoadW(r1x), R1y = LoadW(r1y);
+	FloatW R2x = LoadW(r2x), R2y = LoadW(r2y);
+	FloatW PX = LoadW(Px), PY = LoadW(Py);
+	FloatW S = LoadW(softness);
+
+	// dv = v2 + w2 x r2 - v1 - w1 x r1
+	FloatW dvx = SubW(AddW(SubW(V2x, MulW(W2, R2y)), MulW(W1, R1y)), V1x);
+	FloatW dvy = SubW(SubW(AddW(V2y, MulW(W2, R2x)), MulW(W1, R1x)), V1y);
+
+	// error = bias - dv - softness * P
+	FloatW ex = SubW(SubW(LoadW(biasX), dvx), MulW(S, PX));
+	FloatW ey = SubW(SubW(LoadW(biasY), dvy), MulW(S, PY));
+
+	// impulse = M * error
+	FloatW ix = AddW(MulW(LoadW(m11), ex), MulW(LoadW(m12), ey));
+	FloatW iy = AddW(MulW(LoadW(m21), ex), MulW(LoadW(m22), ey));
+
+	FloatW IM1 = LoadW(invMass1), II1 = LoadW(invI1);
+	FloatW IM2 = LoadW(invMass2), II2 = LoadW(invI2);
+
+	V1x = SubW(V1x, MulW(IM1, ix));
+	V1y = SubW(V1y, MulW(IM1, iy));
+	W1 = SubW(W1, MulW(II1, SubW(MulW(R1x, iy), MulW(R1y, ix))));
+
+	V2x = AddW(V2x, MulW(IM2, ix));
+	V2y = AddW(V2y, MulW(IM2, iy));
+	W2 = AddW(W2, MulW(II2, SubW(MulW(R2x, iy), MulW(R2y, ix))));
+
+	StoreW(Px, AddW(PX, ix));
+	StoreW(Py, AddW(PY, iy));
+
+	StoreW(v1x, V1x); StoreW(v1y, V1y); StoreW(w1, W1);
+	StoreW(v2x, V2x); StoreW(v2y, V2y); StoreW(w2, W2);
+
+	float error[WIDTH];
+	StoreW(error, MaxW(AbsW(ex), AbsW(ey)));
+
+	float residual = 0.0f;
+	for (int i = 0; i < count; ++i)
+	{
+		body1[i]->StoreVelocity(Vec2(v1x[i], v1y[i]), w1[i]);
+		body2[i]->StoreVelocity(Vec2(v2x[i], v2y[i]), w2[i]);
+		residual = Max(residual, error[i]);
+	}
+
+	return residual;
+}
+
+int BatchJoints(Joint** joints, int jointCount, JointBatch* batches)
+{
+	// Only look at the last few batches. Searching all of them makes
+	// batching quadratic and barely fills them better.
+	const int k_searchWindow = 8;
+
+	int batchCount = 0;
+	for (int i = 0; i < jointCount; ++i)
+	{
+		int b = batchCount > k_searchWindow ? batchCount - k_searchWindow : 0;
+		while (b < batchCount && batches[b].CanAdd(joints[i]) == false)
+			++b;
+
+		if (b == batchCount)
+		{
+			memset(batches + b, 0, sizeof(JointBatch));
+			++batchCount;
+		}
+
+		batches[b].Add(joints[i]);
+	}
+
+	return batchCount;
+}
@@ -0,0 +1,150 @@
+/*
+* Copyright (c) 2006-2009 Erin Catto http://www.gphysics.com
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee,
+* provided that the above copyright notice appear in all copies.
+* Erin Catto makes no representations about the suitability
+* of this software for any purpose.
+* It is provided "as is" without express or implied warranty.
+*/
+
+#include "box2d-lite/ThreadPool.h"
+
+// Threads that don't belong to a pool share slot 0 of that pool.
+static thread_local const ThreadPool* s_currentPool = 0;
+static thread_local int s_currentSlot = 0;
+
+ThreadPool::ThreadPool(int threadCount) : threadCount(threadCount < 1 ? 1 : threadCount), queuedTasks(0), stop(false)
+{
+	for (int i = 0; i < this->threadCount; ++i)
+		queues.push_back(new WorkQueue);
+
+	for (int i = 1; i < this->threadCount; ++i)
+		threads.push_back(std::thread(&ThreadPool::WorkerMain, this, i));
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		stop = true;
+	}
+	wakeCondition.notify_all();
+
+	for (int i = 0; i < (int)threads.size(); ++i)
+		threads[i].join();
+
+	for (int i = 0; i < (int)queues.size(); ++i)
+		delete queues[i];
+}
+
+int ThreadPool::CurrentSlot() const
+{
+	return s_currentPool == this ? s_currentSlot : 0;
+}
+
+void ThreadPool::ParallelFor(TaskFunction* function, void* context, int count)
+{
+	if (count <= 0)
+		return;
+
+	if (threadCount == 1 || count == 1)
+	{
+		for (int i = 0; i < count; ++i)
+			function(context, i);
+		return;
+	}
+
+	Job job;
+	job.function = function;
+	job.context = context;
+	job.remaining.store(count);
+
+	// Deal the tasks out round robin, starting with our own queue. Owners pop
+	// from the front and thieves steal from the back, so every thread starts
+	// on one of the most expensive tasks.
+	int self = CurrentSlot();
+	for (int k = 0; k < threadCount && k < count; ++k)
+	{
+		WorkQueue* queue = queues[(self + k) % threadCount];
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		for (int i = k; i < count; i += threadCount)
+		{
+			Task task = {&job, i};
+			queue->tasks.push_back(task);
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		queuedTasks += count;
+	}
+	wakeCondition.notify_all();
+
+	// Help out until every task of this job is done. This may run tasks of
+	// other jobs, which is what keeps nested calls from deadlocking.
+	while (job.remaining.load(std::memory_order_acquire) > 0)
+	{
+		if (RunTask(self) == false)
+			std::this_thread::yield();
+	}
+}
+
+bool ThreadPool::RunTask(int slot)
+{
+	Task task;
+	bool found = false;
+
+	{
+		WorkQueue* queue = queues[slot];
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		if (queue->tasks.empty() == false)
+		{
+			task = queue->tasks.front();
+			queue->tasks.pop_front();
+			found = true;
+		}
+	}
+
+	for (int k = 1; k < threadCount && found == false; ++k)
+	{
+		WorkQueue* victim = queues[(slot + k) % threadCount];
+		std::lock_guard<std::mutex> lock(victim->mutex);
+		if (victim->tasks.empty() == false)
+		{
+			task = victim->tasks.back();
+			victim->tasks.pop_back();
+			found = true;
+		}
+	}
+
+	if (found == false)
+		return false;
+
+	--queuedTasks;
+
+	Job* job = task.job;
+	job->function(job->context, task.index);
+
+	// The job lives on the stack of ParallelFor, don't touch it after this.
+	job->remaining.fetch_sub(1, std::memory_order_acq_rel);
+	return true;
+}
+
+void ThreadPool::WorkerMain(int slot)
+{
+	s_currentPool = this;
+	s_currentSlot = slot;
+
+	for (;;)
+	{
+		if (RunTask(slot))
+			continue;
+
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		wakeCondition.wait(lock, [this] { return stop || queuedTasks.load() > 0; });
+		if (stop)
+			return;
+	}
+}
@@ -0,0 +1,185 @@
+/*
+* Copyright (c) 2006-2009 Erin Catto http://www.gphysics.com
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee,
+* provided that the above copyright notice appear in all copies.
+* Erin Catto makes no representations about the suitability
+* of this software for any purpose.
+* It is provided "as is" without express or implied warranty.
+*/
+
+#include "box2d-lite/TimeOfImpact.h"
+#include "box2d-lite/Body.h"
+
+// A shape placed in the world: the vertices of a convex polygon, or the
+// center of a circle with its radius. A chain segment is a polygon with
+// two vertices and a normal for each side, and a compound is one of its
+// boxes.
+struct Proxy
+{
+	Proxy(const Body* body, int child, const Vec2& position, const Mat22& R)
+	{
+		radius = 0.0f;
+
+		if (body->shape == Body::CIRCLE)
+		{
+			vertices[0] = position;
+			count = 1;
+			radius = body->radius;
+		}
+		else if (body->shape == Body::CHAIN)
+		{
+			vertices[0] = position + R * body->chain->Vertex(child);
+			vertices[1] = position + R * body->chain->Vertex(child + 1);
+			Vec2 e = vertices[1] - vertices[0];
+			normals[0] = Cross(1.0f / e.Length(), e);
+			normals[1] = -normals[0];
+			count = 2;
+		}
+		else if (body->shape == Body::POLYGON)
+		{
+			const Polygon* polygon = body->polygon;
+			count = polygon->count;
+			for (int i = 0; i < count; ++i)
+			{
+				vertices[i] = position + R * polygon->vertices[i];
+				normals[i] = R * polygon->normals[i];
+			}
+		}
+		else if (body->shape == Body::COMPOUND)
+		{
+			const Compound::Child& c = body->compound->children[child];
+			SetBox(position + R * c.position, R * c.R, 0.5f * c.width);
+		}
+		else
+		{
+			SetBox(position, R, 0.5f * body->width);
+		}
+	}
+
+	void SetBox(const Vec2& position, const Mat22& R, const Vec2& h)
+	{
+		vertices[0] = position + R * Vec2(-h.x, -h.y);
+		vertices[1] = position + R * Vec2( h.x, -h.y);
+		vertices[2] = position + R * Vec2( h.x,  h.y);
+		vertices[3] = position + R * Vec2(-h.x,  h.y);
+		normals[0] = -R.col2;
+		normals[1] = R.col1;
+		normals[2] = R.col2;
+		normals[3] = -R.col1;
+		count = 4;
+	}
+
+	Vec2 vertices[Polygon::MAX_VERTICES];
+	Vec2 normals[Polygon::MAX_VERTICES];
+	int count;
+	float radius;
+};
+
+// Largest separation of the vertices of B from a face of polygon A.
+static float MaxSeparation(const Proxy& A, const Proxy& B)
+{
+	float maxSeparation = -FLT_MAX;
+	for (int i = 0; i < A.count; ++i)
+	{
+		float separation = FLT_MAX;
+		for (int j = 0; j < B.count; ++j)
+		{
+			separation = Min(separation, Dot(A.normals[i], B.vertices[j] - A.vertices[i]));
+		}
+		maxSeparation = Max(maxSeparation, separation);
+	}
+	return maxSeparation;
+}
+
+static float DistanceToSegment(const Vec2& p, const Vec2& a, const Vec2& b)
+{
+	Vec2 e = b - a;
+	float lengthSq = Dot(e, e);
+	float t = lengthSq > 0.0f ? Clamp(Dot(p - a, e) / lengthSq, 0.0f, 1.0f) : 0.0f;
+	return (p - (a + t * e)).Length();
+}
+
+// Nearest distance from a vertex of A to an edge of B. A circle's only
+// edge is its center.
+static float BoundaryDistance(const Proxy& A, const Proxy& B)
+{
+	float distance = FLT_MAX;
+	for (int i = 0; i < A.count; ++i)
+	{
+		for (int j = 0; j < B.count; ++j)
+		{
+			const Vec2& b1 = B.vertices[j];
+			const Vec2& b2 = B.vertices[j + 1 < B.count ? j + 1 : 0];
+			distance = Min(distance, DistanceToSegment(A.vertices[i], b1, b2));
+		}
+	}
+	return distance;
+}
+
+float Distance(const Body* bodyA, int childA, const Vec2& positionA, const Mat22& RotA,
+			   const Body* bodyB, int childB, const Vec2& positionB, const Mat22& RotB)
+{
+	Proxy A(bodyA, childA, positionA, RotA);
+	Proxy B(bodyB, childB, positionB, RotB);
+
+	// Polygons overlap if no face separates them. A circle overlaps a
+	// polygon that holds its center.
+	if (A.count > 1 && MaxSeparation(A, B) <= 0.0f && (B.count == 1 || MaxSeparation(B, A) <= 0.0f))
+		return 0.0f;
+
+	if (B.count > 1 && A.count == 1 && MaxSeparation(B, A) <= 0.0f)
+		return 0.0f;
+
+	// Separated convex shapes are nearest at a vertex of one and an edge of
+	// the other.
+	float distance = Min(BoundaryDistance(A, B), BoundaryDistance(B, A)) - A.radius - B.radius;
+	return Max(distance, 0.0f);
+}
+
+float TimeOfImpact(const Body* body, int bodyChild, const Body* other, int otherChild)
+{
+	// The advancement stops within k_tolerance of the other shape, then
+	// moves on by at most k_depth so the next step finds a contact.
+	const float k_tolerance = 0.005f;
+	const float k_depth = 0.01f;
+	const int k_maxIterations = 20;
+
+	Vec2 dp = body->position - body->position0;
+	float da = body->rotation - body->rotation0;
+
+	// No point of the body moves farther than this over the step.
+	float maxMotion = dp.Length() + Abs(da) * 0.5f * body->width.Length();
+	if (maxMotion < k_tolerance)
+		return 1.0f;
+
+	Mat22 R(other->rotation);
+
+	// A chain segment only stops bodies coming from its front.
+	if (other->shape == Body::CHAIN)
+	{
+		Proxy segment(other, otherChild, other->position, R);
+		if (Dot(segment.normals[0], body->position0 - segment.vertices[0]) < 0.0f)
+			return 1.0f;
+	}
+
+	float t = 0.0f;
+	for (int i = 0; i < k_maxIterations; ++i)
+	{
+		float distance = Distance(body, bodyChild, body->position0 + t * dp, Mat22(body->rotation0 + t * da),
+								  other, otherChild, other->position, R);
+
+		if (distance == 0.0f && t == 0.0f)
+			return 1.0f;
+
+		if (distance < k_tolerance)
+			break;
+
+		t += distance / maxMotion;
+		if (t >= 1.0f)
+			return 1.0f;
+	}
+
+	return Min(t + (k_tolerance + k_depth) / maxMotion, 1.0f);
+}
@@ -12,6 +12,10 @@
 #include "box2d-lite/World.h"
 #include "box2d-lite/Body.h"
 #include "box2d-lite/Joint.h"
+#include "box2d-lite/ThreadPool.h"
+#include "box2d-lite/TimeOfImpact.h"
+
+#include <algorithm>
 
 using std::vector;
 using std::map;
@@ -20,10 +24,6 @@ using std::pair;
 typedef map<ArbiterKey, Arbiter>::iterator ArbIter;
 typedef pair<ArbiterKey, Arbiter> ArbPair;
 
-bool World::accumulateImpulses = true;
-bool World::warmStarting = true;
-bool World::positionCorrection = true;
-
 void World::Add(Body* body)
 {
 	bodies.push_back(body);
@@ -41,96 +41,1031 @@ void World::Clear()
 	arbiters.clear();
 }
 
-void World::BroadPhase()
+void World::BroadPhase(float dt)
 {
-	// O(n^2) broad-phase
-	for (int i = 0; i < (int)bodies.size(); ++i)
+	if (stepSettings.warmStarting)
+		BroadPhase<true>(dt);
+	else
+		BroadPhase<false>(dt);
+}
+
+static bool ShouldCollide(const Body* b1, const Body* b2)
+{
+	if (b1->invMass == 0.0f && b2->invMass == 0.0f)
+		return false;
+
+	if (b1->groupIndex == b2->groupIndex && b1->groupIndex != 0)
+		return b1->groupIndex > 0;
+
+	return (b1->categoryBits & b2->maskBits) != 0 && (b2->categoryBits & b1->maskBits) != 0;
+}
+
+// The children of body that may be within radius of center: the segments
+// of a chain, the boxes of a compound, or just 0 for other shapes.
+static void QueryChildren(vector<int>* children, const Body* body, const Mat22& R, const Vec2& center, float radius)
+{
+	children->clear();
+
+	if (body->shape != Body::CHAIN && body->shape != Body::COMPOUND)
+	{
+		children->push_back(0);
+		return;
+	}
+
+	Vec2 c = R.Transpose() * (center - body->position);
+	Vec2 r(radius, radius);
+
+	if (body->shape == Body::CHAIN)
+	{
+		body->chain->Query(children, c - r, c + r);
+	}
+	else
+	{
+		int result[Compound::MAX_CHILDREN];
+		int count = body->compound->Query(result, c - r, c + r);
+		children->insert(children->end(), result, result + count);
+	}
+}
+
+// A circle around a child of body, with children as in QueryChildren.
+static void ChildBounds(Vec2* center, float* radius, const Body* body, const Mat22& R, int child)
+{
+	if (body->shape == Body::CHAIN)
+	{
+		const Vec2& v1 = body->chain->Vertex(child);
+		const Vec2& v2 = body->chain->Vertex(child + 1);
+		*center = body->position + R * (0.5f * (v1 + v2));
+		*radius = 0.5f * (v2 - v1).Length();
+	}
+	else if (body->shape == Body::COMPOUND)
+	{
+		const Compound::Child& c = body->compound->children[child];
+		*center = body->position + R * c.position;
+		*radius = 0.5f * c.width.Length();
+	}
+	else
+	{
+		*center = body->position;
+		*radius = 0.5f * body->width.Length();
+	}
+}
+
+template <bool warm>
+void World::BroadPhase(float dt)
+{
+	int bodyCount = (int)bodies.size();
+
+	// O(n^2) broad-phase. The candidate pairs are collected first, then
+	// collided together by NarrowPhase.
+	candidatePairs.clear();
+
+	// The bounding circle of each body, which holds every point of it.
+	boundingRadii.resize(bodyCount);
+	for (int i = 0; i < bodyCount; ++i)
+		boundingRadii[i] = 0.5f * bodies[i]->width.Length();
+
+	for (int i = 0; i < bodyCount; ++i)
 	{
 		Body* bi = bodies[i];
+		float ri = boundingRadii[i];
+		bool childrenI = bi->shape == Body::CHAIN || bi->shape == Body::COMPOUND;
 
-		for (int j = i + 1; j < (int)bodies.size(); ++j)
+		for (int j = i + 1; j < bodyCount; ++j)
 		{
 			Body* bj = bodies[j];
+			float rj = boundingRadii[j];
 
-			if (bi->invMass == 0.0f && bj->invMass == 0.0f)
+			if (ShouldCollide(bi, bj) == false)
 				continue;
 
-			Arbiter newArb(bi, bj);
-			ArbiterKey key(bi, bj);
+			float margin = 0.0f;
 
-			if (newArb.numContacts > 0)
+			if (stepSettings.speculativeContacts)
 			{
-				ArbIter iter = arbiters.find(key);
-				if (iter == arbiters.end())
-				{
-					arbiters.insert(ArbPair(key, newArb));
-				}
-				else
+				// The most the gap can close over the step at the current
+				// velocities.
+				Vec2 dv = bj->velocity - bi->velocity;
+				float w = Abs(bi->angularVelocity) * ri + Abs(bj->angularVelocity) * rj;
+				margin = dt * (dv.Length() + w);
+			}
+
+			// Bodies whose bounding circles are apart can't have contacts.
+			Vec2 d = bj->position - bi->position;
+			float reach = ri + rj + margin;
+			if (Dot(d, d) > reach * reach)
+				continue;
+
+			if (childrenI == false && bj->shape != Body::CHAIN && bj->shape != Body::COMPOUND)
+			{
+				CandidatePair pair = {ArbiterKey(bi, bj, 0, 0), margin};
+				candidatePairs.push_back(pair);
+				continue;
+			}
+
+			// Pair only the children that may touch: the segments of a
+			// chain near the other body, or the boxes of compounds whose
+			// bounds overlap.
+			QueryChildren(&pairChildren1, bi, bi->rotationMatrix, bj->position, rj + margin);
+
+			for (int k = 0; k < (int)pairChildren1.size(); ++k)
+			{
+				Vec2 center;
+				float radius;
+				ChildBounds(&center, &radius, bi, bi->rotationMatrix, pairChildren1[k]);
+				QueryChildren(&pairChildren2, bj, bj->rotationMatrix, center, radius + margin);
+
+				for (int l = 0; l < (int)pairChildren2.size(); ++l)
 				{
-					iter->second.Update(newArb.contacts, newArb.numContacts);
+					CandidatePair pair = {ArbiterKey(bi, bj, pairChildren1[k], pairChildren2[l]), margin};
+					candidatePairs.push_back(pair);
 				}
 			}
+		}
+	}
+
+	NarrowPhase();
+	UpdateArbiters<warm>();
+}
+
+static void CollidePairsTask(void* context, int index)
+{
+	World* world = (World*)context;
+	World::CollideTask* task = &world->collideTasks[index];
+	task->manifolds.clear();
+
+	// Only the pairs that touch are kept, most candidates are apart.
+	const int k_collideBatch = 64;
+	CollidePair batch[k_collideBatch];
+
+	for (int begin = task->begin; begin < task->end; begin += k_collideBatch)
+	{
+		int count = task->end - begin < k_collideBatch ? task->end - begin : k_collideBatch;
+		for (int i = 0; i < count; ++i)
+		{
+			const CandidatePair& candidate = world->candidatePairs[begin + i];
+			CollidePair* pair = batch + i;
+			pair->body1 = candidate.key.body1;
+			pair->body2 = candidate.key.body2;
+			pair->child1 = candidate.key.child1;
+			pair->child2 = candidate.key.child2;
+			pair->margin = candidate.margin;
+		}
+
+		CollidePairs(batch, count);
+
+		for (int i = 0; i < count; ++i)
+		{
+			if (batch[i].numContacts > 0)
+				task->manifolds.push_back(batch[i]);
+		}
+	}
+}
+
+void World::NarrowPhase()
+{
+	int pairCount = (int)candidatePairs.size();
+	int taskCount = 1;
+
+	// Each task collides a run of pairs into its own buffer, so the result
+	// is the same for any number of threads. There are a few runs per
+	// thread, as resting and separated pairs cost very different amounts.
+	if (threadPool != NULL && threadPool->GetThreadCount() > 1)
+	{
+		const int k_minTaskPairs = 256;
+		int maxTasks = 4 * threadPool->GetThreadCount();
+		taskCount = pairCount / k_minTaskPairs;
+		taskCount = taskCount < maxTasks ? taskCount : maxTasks;
+		taskCount = taskCount > 1 ? taskCount : 1;
+	}
+
+	// The tasks keep their buffers from step to step.
+	if ((int)collideTasks.size() < taskCount)
+		collideTasks.resize(taskCount);
+
+	for (int i = 0; i < taskCount; ++i)
+	{
+		collideTasks[i].begin = (int)((long long)i * pairCount / taskCount);
+		collideTasks[i].end = (int)((long long)(i + 1) * pairCount / taskCount);
+	}
+
+	for (int i = taskCount; i < (int)collideTasks.size(); ++i)
+	{
+		collideTasks[i].begin = collideTasks[i].end = 0;
+		collideTasks[i].manifolds.clear();
+	}
+
+	if (taskCount == 1)
+		CollidePairsTask(this, 0);
+	else
+		threadPool->ParallelFor(CollidePairsTask, this, taskCount);
+}
+
+template <bool warm>
+void World::UpdateArbiters()
+{
+	// The tasks hold the touching pairs in the order the broadphase found
+	// them, which depends only on the order of the bodies.
+	for (int i = 0; i < (int)collideTasks.size(); ++i)
+	{
+		const vector<CollidePair>& manifolds = collideTasks[i].manifolds;
+
+		for (int j = 0; j < (int)manifolds.size(); ++j)
+		{
+			const CollidePair& pair = manifolds[j];
+			ArbiterKey key(pair.body1, pair.body2, pair.child1, pair.child2);
+
+			ArbIter iter = arbiters.find(key);
+			if (iter == arbiters.end())
+			{
+				arbiters.insert(ArbPair(key, Arbiter(pair)));
+			}
 			else
 			{
-				arbiters.erase(key);
+				iter->second.Update<warm>(pair.contacts, pair.numContacts);
+				iter->second.paired = true;
 			}
 		}
 	}
+
+	// The pairs that were apart or not paired at all lose their arbiters.
+	for (ArbIter iter = arbiters.begin(); iter != arbiters.end();)
+	{
+		if (iter->second.paired)
+		{
+			iter->second.paired = false;
+			++iter;
+		}
+		else
+		{
+			arbiters.erase(iter++);
+		}
+	}
 }
 
-void World::Step(float dt)
+static int FindRoot(vector<int>& parents, int i)
 {
-	float inv_dt = dt > 0.0f ? 1.0f / dt : 0.0f;
+	while (parents[i] != i)
+	{
+		parents[i] = parents[parents[i]];
+		i = parents[i];
+	}
+	return i;
+}
 
-	// Determine overlapping bodies and update contact points.
-	BroadPhase();
+static void Union(vector<int>& parents, Body* b1, Body* b2)
+{
+	// Static bodies don't propagate islands.
+	if (b1->invMass == 0.0f || b2->invMass == 0.0f)
+		return;
 
-	// Integrate forces.
-	for (int i = 0; i < (int)bodies.size(); ++i)
+	// Keep the smallest index as the root, so a root comes first in its set.
+	int root1 = FindRoot(parents, b1->index);
+	int root2 = FindRoot(parents, b2->index);
+	if (root1 < root2)
+		parents[root2] = root1;
+	else if (root2 < root1)
+		parents[root1] = root2;
+}
+
+void World::BuildIslands()
+{
+	int bodyCount = (int)bodies.size();
+
+	// Union-find over contacts and joints. islandIds holds the parent links
+	// until the islands are numbered.
+	islandIds.resize(bodyCount);
+	for (int i = 0; i < bodyCount; ++i)
 	{
-		Body* b = bodies[i];
+		bodies[i]->index = i;
+		islandIds[i] = i;
+	}
+
+	for (ArbIter arb = arbiters.begin(); arb != arbiters.end(); ++arb)
+	{
+		Union(islandIds, arb->second.body1, arb->second.body2);
+	}
+
+	for (int i = 0; i < (int)joints.size(); ++i)
+	{
+		Union(islandIds, joints[i]->body1, joints[i]->body2);
+	}
+
+	for (int i = 0; i < bodyCount; ++i)
+		islandIds[i] = FindRoot(islandIds, i);
+
+	// Number the islands in order of their first body, which is the root of
+	// the set. This keeps the layout independent of how sets were merged.
+	islands.clear();
+	for (int i = 0; i < bodyCount; ++i)
+	{
+		if (bodies[i]->invMass == 0.0f)
+		{
+			islandIds[i] = -1;
+			continue;
+		}
+
+		int root = islandIds[i];
+		if (root == i)
+		{
+			Island island = {NULL, NULL, NULL, 0, 0, 0};
+			islandIds[i] = (int)islands.size();
+			islands.push_back(island);
+		}
+		else
+		{
+			islandIds[i] = islandIds[root];
+		}
+
+		islands[islandIds[i]].bodyCount += 1;
+	}
+
+	for (ArbIter arb = arbiters.begin(); arb != arbiters.end(); ++arb)
+	{
+		Body* b = arb->second.body1->invMass > 0.0f ? arb->second.body1 : arb->second.body2;
+		islands[islandIds[b->index]].arbiterCount += 1;
+	}
+
+	for (int i = 0; i < (int)joints.size(); ++i)
+	{
+		Body* b = joints[i]->body1->invMass > 0.0f ? joints[i]->body1 : joints[i]->body2;
+		if (b->invMass > 0.0f)
+			islands[islandIds[b->index]].jointCount += 1;
+	}
+
+	// Lay the islands out back to back. The counts are rebuilt while filling.
+	int islandCount = (int)islands.size();
+	int bodyOffset = 0, arbiterOffset = 0, jointOffset = 0;
+
+	islandBodies.resize(bodyCount);
+	islandArbiters.resize(arbiters.size());
+	islandJoints.resize(joints.size());
+
+	for (int i = 0; i < islandCount; ++i)
+	{
+		Island* island = &islands[i];
+		island->bodies = islandBodies.data() + bodyOffset;
+		island->arbiters = islandArbiters.data() + arbiterOffset;
+		island->joints = islandJoints.data() + jointOffset;
+		bodyOffset += island->bodyCount;
+		arbiterOffset += island->arbiterCount;
+		jointOffset += island->jointCount;
+		island->bodyCount = 0;
+		island->arbiterCount = 0;
+		island->jointCount = 0;
+	}
+
+	for (int i = 0; i < bodyCount; ++i)
+	{
+		if (islandIds[i] == -1)
+			continue;
 
+		Island* island = &islands[islandIds[i]];
+		island->bodies[island->bodyCount++] = bodies[i];
+	}
+
+	for (ArbIter arb = arbiters.begin(); arb != arbiters.end(); ++arb)
+	{
+		Body* b = arb->second.body1->invMass > 0.0f ? arb->second.body1 : arb->second.body2;
+		Island* island = &islands[islandIds[b->index]];
+		island->arbiters[island->arbiterCount++] = &arb->second;
+	}
+
+	for (int i = 0; i < (int)joints.size(); ++i)
+	{
+		Body* b = joints[i]->body1->invMass > 0.0f ? joints[i]->body1 : joints[i]->body2;
 		if (b->invMass == 0.0f)
 			continue;
 
-		b->velocity += dt * (gravity + b->invMass * b->force);
-		b->angularVelocity += dt * b->invI * b->torque;
+		Island* island = &islands[islandIds[b->index]];
+		island->joints[island->jointCount++] = joints[i];
+	}
+
+	if (stepSettings.solverType == JACOBI || stepSettings.solverType == MASS_SPLITTING)
+		BuildDeltaLists();
+
+	if (stepSettings.directJointSolver && stepSettings.solverType == SEQUENTIAL_IMPULSE)
+		BuildJointTrees();
+
+	if (stepSettings.simdJointSolver && stepSettings.solverType == SEQUENTIAL_IMPULSE)
+	{
+		jointBatches.resize(joints.size());
+		for (int i = 0; i < islandCount; ++i)
+			islands[i].jointBatches = jointBatches.data() + (islands[i].joints - islandJoints.data());
+	}
+
+	// The partitioner walks the edges found by ComputeDepths. It only knows
+	// the plain joint solver.
+	bool partition = stepSettings.partitionIslands && stepSettings.solverType == SEQUENTIAL_IMPULSE && stepSettings.directJointSolver == false && stepSettings.simdJointSolver == false;
+
+	if (stepSettings.adaptiveIterations || stepSettings.shockPropagation || partition)
+	{
+		ComputeDepths();
+
+		for (int i = 0; i < bodyCount; ++i)
+		{
+			if (islandIds[i] == -1)
+				continue;
+
+			Island* island = &islands[islandIds[i]];
+			if (bodies[i]->depth > island->depth)
+				island->depth = bodies[i]->depth;
+		}
+	}
+
+	if (partition)
+		PartitionIslands();
+}
+
+// Adds an entry to the row of a dynamic body. Rows are filled back to front,
+// see ComputeDepths.
+static void AddEntry(vector<int>& offsets, vector<int>& entries, Body* b, int entry)
+{
+	if (b->invMass > 0.0f)
+		entries[--offsets[b->index]] = entry;
+}
+
+// Lists the delta slots of every dynamic body. The lists are in a fixed
+// order, so the sums don't depend on which thread solved what.
+void World::BuildDeltaLists()
+{
+	int bodyCount = (int)bodies.size();
+	int islandCount = (int)islands.size();
+
+	jacobiDeltas.resize(2 * (arbiters.size() + joints.size()));
+	jacobiOffsets.assign(bodyCount + 1, 0);
+
+	int residualCount = 0;
+	for (int i = 0; i < islandCount; ++i)
+	{
+		int constraintCount = islands[i].arbiterCount + islands[i].jointCount;
+		residualCount += (constraintCount + Island::JACOBI_BATCH_SIZE - 1) / Island::JACOBI_BATCH_SIZE;
+	}
+	jacobiResiduals.resize(residualCount);
+
+	int deltaOffset = 0, residualOffset = 0;
+	for (int i = 0; i < islandCount; ++i)
+	{
+		Island* island = &islands[i];
+		int constraintCount = island->arbiterCount + island->jointCount;
+		island->deltas = jacobiDeltas.data() + deltaOffset;
+		island->residuals = jacobiResiduals.data() + residualOffset;
+		deltaOffset += 2 * constraintCount;
+		residualOffset += (constraintCount + Island::JACOBI_BATCH_SIZE - 1) / Island::JACOBI_BATCH_SIZE;
+
+		for (int k = 0; k < island->arbiterCount; ++k)
+		{
+			jacobiOffsets[island->arbiters[k]->body1->index] += 1;
+			jacobiOffsets[island->arbiters[k]->body2->index] += 1;
+		}
+
+		for (int k = 0; k < island->jointCount; ++k)
+		{
+			jacobiOffsets[island->joints[k]->body1->index] += 1;
+			jacobiOffsets[island->joints[k]->body2->index] += 1;
+		}
+	}
+
+	// Static bodies were counted too but get no slots.
+	for (int i = 0; i < bodyCount; ++i)
+	{
+		if (bodies[i]->invMass == 0.0f)
+			jacobiOffsets[i] = 0;
+	}
+
+	// Same layout as in ComputeDepths.
+	for (int i = 1; i < bodyCount; ++i)
+		jacobiOffsets[i] += jacobiOffsets[i - 1];
+	if (bodyCount > 0)
+		jacobiOffsets[bodyCount] = jacobiOffsets[bodyCount - 1];
+
+	jacobiSlots.resize(jacobiOffsets[bodyCount]);
+
+	for (int i = 0; i < islandCount; ++i)
+	{
+		Island* island = &islands[i];
+
+		for (int k = 0; k < island->arbiterCount; ++k)
+		{
+			AddEntry(jacobiOffsets, jacobiSlots, island->arbiters[k]->body1, 2 * k);
+			AddEntry(jacobiOffsets, jacobiSlots, island->arbiters[k]->body2, 2 * k + 1);
+		}
+
+		for (int k = 0; k < island->jointCount; ++k)
+		{
+			int slot = 2 * (island->arbiterCount + k);
+			AddEntry(jacobiOffsets, jacobiSlots, island->joints[k]->body1, slot);
+			AddEntry(jacobiOffsets, jacobiSlots, island->joints[k]->body2, slot + 1);
+		}
+
+		island->deltaOffsets = jacobiOffsets.data();
+		island->deltaSlots = jacobiSlots.data();
+	}
+}
+
+// Lays out the joints of each island and their bodies as trees for the
+// direct solver. Static bodies all belong to the same unmoving ground, so
+// two joints to it close a loop. An island whose joints form a loop keeps
+// the iterative joint solver.
+void World::BuildJointTrees()
+{
+	int bodyCount = (int)bodies.size();
+	int jointCount = (int)islandJoints.size();
+
+	// The joints of each dynamic body, by position in islandJoints.
+	bodyJointOffsets.assign(bodyCount + 1, 0);
+	for (int k = 0; k < jointCount; ++k)
+	{
+		Joint* joint = islandJoints[k];
+		if (joint->body1->invMass > 0.0f)
+			bodyJointOffsets[joint->body1->index] += 1;
+		if (joint->body2->invMass > 0.0f)
+			bodyJointOffsets[joint->body2->index] += 1;
+	}
+
+	for (int i = 1; i < bodyCount; ++i)
+		bodyJointOffsets[i] += bodyJointOffsets[i - 1];
+	if (bodyCount > 0)
+		bodyJointOffsets[bodyCount] = bodyJointOffsets[bodyCount - 1];
+
+	bodyJoints.resize(bodyJointOffsets[bodyCount]);
+	for (int k = 0; k < jointCount; ++k)
+	{
+		AddEntry(bodyJointOffsets, bodyJoints, islandJoints[k]->body1, k);
+		AddEntry(bodyJointOffsets, bodyJoints, islandJoints[k]->body2, k);
+	}
+
+	bodyNodeIds.assign(bodyCount, -1);
+	jointNodeIds.assign(jointCount, -1);
+	jointNodes.resize(bodyCount + jointCount);
+
+	int nodeOffset = 0;
+	for (int i = 0; i < (int)islands.size(); ++i)
+	{
+		Island* island = &islands[i];
+		island->jointNodes = jointNodes.data() + nodeOffset;
+		island->jointNodeCount = 0;
+
+		// Grow the pinned trees from their joint to the ground first, so
+		// any joint to the ground met later closes a loop.
+		int first = (int)(island->joints - islandJoints.data());
+		bool acyclic = true;
+		for (int pass = 0; pass < 2 && acyclic; ++pass)
+		{
+			for (int k = first; k < first + island->jointCount && acyclic; ++k)
+			{
+				Joint* joint = islandJoints[k];
+				bool pinned = joint->body1->invMass == 0.0f || joint->body2->invMass == 0.0f;
+				if (jointNodeIds[k] == -1 && pinned == (pass == 0))
+					acyclic = AddJointTree(island, k);
+			}
+		}
+
+		if (acyclic)
+			nodeOffset += island->jointNodeCount;
+		else
+			island->jointNodeCount = 0;
+	}
+}
+
+// Breadth first from the root, so parents come before their children.
+// Returns false if the tree would contain a loop.
+bool World::AddJointTree(Island* island, int root)
+{
+	JointNode* nodes = island->jointNodes;
+
+	JointNode rootNode = {NULL, islandJoints[root], -1};
+	jointNodeIds[root] = island->jointNodeCount;
+	nodes[island->jointNodeCount++] = rootNode;
+
+	for (int n = jointNodeIds[root]; n < island->jointNodeCount; ++n)
+	{
+		if (nodes[n].joint != NULL)
+		{
+			Body* parent = nodes[n].parent != -1 ? nodes[nodes[n].parent].body : NULL;
+			Body* pair[2] = {nodes[n].joint->body1, nodes[n].joint->body2};
+
+			for (int k = 0; k < 2; ++k)
+			{
+				Body* b = pair[k];
+				if (b->invMass == 0.0f || b == parent)
+					continue;
+
+				if (bodyNodeIds[b->index] != -1)
+					return false;
+
+				JointNode node = {b, NULL, n};
+				bodyNodeIds[b->index] = island->jointNodeCount;
+				nodes[island->jointNodeCount++] = node;
+			}
+		}
+		else
+		{
+			Body* b = nodes[n].body;
+			Joint* parent = nodes[nodes[n].parent].joint;
+
+			for (int e = bodyJointOffsets[b->index]; e < bodyJointOffsets[b->index + 1]; ++e)
+			{
+				int k = bodyJoints[e];
+				Joint* joint = islandJoints[k];
+				if (joint == parent)
+					continue;
+
+				if (jointNodeIds[k] != -1 || joint->body1->invMass == 0.0f || joint->body2->invMass == 0.0f)
+					return false;
+
+				JointNode node = {NULL, joint, n};
+				jointNodeIds[k] = island->jointNodeCount;
+				nodes[island->jointNodeCount++] = node;
+			}
+		}
 	}
 
-	// Perform pre-steps.
+	return true;
+}
+
+static void AddEdge(vector<int>& offsets, vector<int>& edges, Body* b1, Body* b2)
+{
+	if (b1->invMass == 0.0f || b2->invMass == 0.0f)
+		return;
+
+	edges[--offsets[b1->index]] = b2->index;
+	edges[--offsets[b2->index]] = b1->index;
+}
+
+// Breadth first search out from the static bodies over contacts and joints.
+// Bodies touching a static body get depth 1, bodies resting on those get
+// depth 2 and so on.
+void World::ComputeDepths()
+{
+	int bodyCount = (int)bodies.size();
+
+	// Count the edges between dynamic bodies and seed the search.
+	bodyEdgeOffsets.assign(bodyCount + 1, 0);
+	bodyQueue.clear();
+
+	for (int i = 0; i < bodyCount; ++i)
+		bodies[i]->depth = bodies[i]->invMass == 0.0f ? 0 : -1;
+
 	for (ArbIter arb = arbiters.begin(); arb != arbiters.end(); ++arb)
 	{
-		arb->second.PreStep(inv_dt);
+		Body* b1 = arb->second.body1;
+		Body* b2 = arb->second.body2;
+		if (b1->invMass > 0.0f && b2->invMass > 0.0f)
+		{
+			bodyEdgeOffsets[b1->index] += 1;
+			bodyEdgeOffsets[b2->index] += 1;
+		}
+		else
+		{
+			Body* b = b1->invMass > 0.0f ? b1 : b2;
+			b->depth = 1;
+		}
+	}
+
+	for (int i = 0; i < (int)joints.size(); ++i)
+	{
+		Body* b1 = joints[i]->body1;
+		Body* b2 = joints[i]->body2;
+		if (b1->invMass > 0.0f && b2->invMass > 0.0f)
+		{
+			bodyEdgeOffsets[b1->index] += 1;
+			bodyEdgeOffsets[b2->index] += 1;
+		}
+		else if (b1->invMass > 0.0f || b2->invMass > 0.0f)
+		{
+			Body* b = b1->invMass > 0.0f ? b1 : b2;
+			b->depth = 1;
+		}
 	}
 
+	// Turn the counts into row ends. Filling the rows back to front leaves
+	// each offset at the start of its row.
+	for (int i = 1; i < bodyCount; ++i)
+		bodyEdgeOffsets[i] += bodyEdgeOffsets[i - 1];
+	if (bodyCount > 0)
+		bodyEdgeOffsets[bodyCount] = bodyEdgeOffsets[bodyCount - 1];
+
+	bodyEdges.resize(bodyEdgeOffsets[bodyCount]);
+
+	for (ArbIter arb = arbiters.begin(); arb != arbiters.end(); ++arb)
+		AddEdge(bodyEdgeOffsets, bodyEdges, arb->second.body1, arb->second.body2);
+
 	for (int i = 0; i < (int)joints.size(); ++i)
+		AddEdge(bodyEdgeOffsets, bodyEdges, joints[i]->body1, joints[i]->body2);
+
+	for (int i = 0; i < bodyCount; ++i)
 	{
-		joints[i]->PreStep(inv_dt);	
+		if (bodies[i]->depth == 1)
+			bodyQueue.push_back(i);
 	}
 
-	// Perform iterations
-	for (int i = 0; i < iterations; ++i)
+	for (int k = 0; k < (int)bodyQueue.size(); ++k)
 	{
-		for (ArbIter arb = arbiters.begin(); arb != arbiters.end(); ++arb)
+		int i = bodyQueue[k];
+		int depth = bodies[i]->depth + 1;
+
+		for (int e = bodyEdgeOffsets[i]; e < bodyEdgeOffsets[i + 1]; ++e)
 		{
-			arb->second.ApplyImpulse();
+			Body* b = bodies[bodyEdges[e]];
+			if (b->depth == -1)
+			{
+				b->depth = depth;
+				bodyQueue.push_back(b->index);
+			}
 		}
+	}
+}
+
+// Which region a constraint belongs to, or regionCount if it joins two.
+static int ConstraintRegion(const vector<int>& bodyRegions, const Body* b1, const Body* b2, int regionCount)
+{
+	if (b1->invMass == 0.0f)
+		return bodyRegions[b2->index];
+	if (b2->invMass == 0.0f)
+		return bodyRegions[b1->index];
+
+	int region = bodyRegions[b1->index];
+	return region == bodyRegions[b2->index] ? region : regionCount;
+}
+
+// Stable sort of the constraints by region. starts gets regionCount + 1
+// entries, the start of each region and of the constraints between them.
+template <typename T>
+static void SortByRegion(T** constraints, int count, int regionCount, const vector<int>& bodyRegions, vector<T*>& scratch, int* starts)
+{
+	int counts[Island::MAX_REGIONS + 1] = {0};
+	for (int i = 0; i < count; ++i)
+		counts[ConstraintRegion(bodyRegions, constraints[i]->body1, constraints[i]->body2, regionCount)] += 1;
+
+	int start = 0;
+	for (int r = 0; r <= regionCount; ++r)
+	{
+		starts[r] = start;
+		start += counts[r];
+		counts[r] = starts[r];
+	}
+
+	scratch.assign(constraints, constraints + count);
+	for (int i = 0; i < count; ++i)
+	{
+		T* constraint = scratch[i];
+		constraints[counts[ConstraintRegion(bodyRegions, constraint->body1, constraint->body2, regionCount)]++] = constraint;
+	}
+}
 
-		for (int j = 0; j < (int)joints.size(); ++j)
+// Splits each large island into regions of about k_regionBodies bodies. The
+// bodies are ordered by a breadth first search from one end of the island
+// and cut into consecutive runs, so a region is a band across the island
+// that only touches the bands next to it. The region count depends only on
+// the island, so the result is the same for any number of threads.
+void World::PartitionIslands()
+{
+	const int k_regionBodies = 128;
+
+	int bodyCount = (int)bodies.size();
+	int islandCount = (int)islands.size();
+
+	int offsetCount = 0;
+	for (int i = 0; i < islandCount; ++i)
+	{
+		Island* island = &islands[i];
+		int regionCount = island->bodyCount / k_regionBodies;
+		if (regionCount > Island::MAX_REGIONS)
+			regionCount = Island::MAX_REGIONS;
+
+		island->regionCount = regionCount > 1 ? regionCount : 0;
+		if (island->regionCount > 0)
+			offsetCount += 2 * (island->regionCount + 1);
+	}
+
+	bodyRegions.assign(bodyCount, -1);
+	regionOffsets.resize(offsetCount);
+
+	int offset = 0;
+	for (int i = 0; i < islandCount; ++i)
+	{
+		Island* island = &islands[i];
+		int regionCount = island->regionCount;
+		if (regionCount == 0)
+			continue;
+
+		// The last body reached from anywhere is at one end of the island.
+		// Search again from there for the final order. The marks are the
+		// number of the last search that reached a body.
+		int start = island->bodies[0]->index;
+		for (int pass = 0; pass < 2; ++pass)
+		{
+			bodyQueue.clear();
+			bodyQueue.push_back(start);
+			bodyRegions[start] = pass;
+
+			for (int k = 0; k < (int)bodyQueue.size(); ++k)
+			{
+				int b = bodyQueue[k];
+				for (int e = bodyEdgeOffsets[b]; e < bodyEdgeOffsets[b + 1]; ++e)
+				{
+					int other = bodyEdges[e];
+					if (bodyRegions[other] != pass)
+					{
+						bodyRegions[other] = pass;
+						bodyQueue.push_back(other);
+					}
+				}
+			}
+
+			start = bodyQueue.back();
+		}
+
+		int count = (int)bodyQueue.size();
+		for (int k = 0; k < count; ++k)
+			bodyRegions[bodyQueue[k]] = k * regionCount / count;
+
+		int* arbiterRegions = regionOffsets.data() + offset;
+		int* jointRegions = arbiterRegions + regionCount + 1;
+		offset += 2 * (regionCount + 1);
+
+		SortByRegion(island->arbiters, island->arbiterCount, regionCount, bodyRegions, regionArbiters, arbiterRegions);
+		SortByRegion(island->joints, island->jointCount, regionCount, bodyRegions, regionJoints, jointRegions);
+
+		island->arbiterRegions = arbiterRegions;
+		island->jointRegions = jointRegions;
+	}
+}
+
+struct IslandTaskContext
+{
+	World* world;
+	Island::SolveFunction solve;
+	float dt;
+};
+
+static void SolveIslandTask(void* context, int index)
+{
+	IslandTaskContext* task = (IslandTaskContext*)context;
+	World* world = task->world;
+
+	int begin = world->islandTasks[index];
+	int end = world->islandTasks[index + 1];
+	for (int i = begin; i < end; ++i)
+	{
+		Island* island = &world->islands[world->islandOrder[i]];
+		(island->*task->solve)(*world, task->dt);
+	}
+}
+
+struct IslandCostGreater
+{
+	const vector<Island>* islands;
+
+	bool operator () (int a, int b) const
+	{
+		return (*islands)[a].Cost() > (*islands)[b].Cost();
+	}
+};
+
+void World::SolveIslands(float dt)
+{
+	int islandCount = (int)islands.size();
+	Island::SolveFunction solve = Island::SelectSolve(*this);
+
+	if (threadPool == NULL || threadPool->GetThreadCount() == 1)
+	{
+		for (int i = 0; i < islandCount; ++i)
+			(islands[i].*solve)(*this, dt);
+		return;
+	}
+
+	// Hand out the big islands first and batch small ones, so a thread never
+	// picks up a task that is cheaper than the cost of stealing it. Which
+	// thread solves an island has no effect on the result.
+	const int k_minTaskCost = 64;
+
+	islandOrder.resize(islandCount);
+	for (int i = 0; i < islandCount; ++i)
+		islandOrder[i] = i;
+
+	IslandCostGreater greater = {&islands};
+	std::stable_sort(islandOrder.begin(), islandOrder.end(), greater);
+
+	islandTasks.clear();
+	int cost = k_minTaskCost;
+	for (int i = 0; i < islandCount; ++i)
+	{
+		if (cost >= k_minTaskCost)
 		{
-			joints[j]->ApplyImpulse();
+			islandTasks.push_back(i);
+			cost = 0;
 		}
+		cost += islands[islandOrder[i]].Cost();
 	}
+	islandTasks.push_back(islandCount);
 
-	// Integrate Velocities
+	IslandTaskContext context = {this, solve, dt};
+	threadPool->ParallelFor(SolveIslandTask, &context, (int)islandTasks.size() - 1);
+}
+
+void World::Step(float dt)
+{
+	stepSettings = settings;
+
+	// The bodies may have been moved since the last step.
+	for (int i = 0; i < (int)bodies.size(); ++i)
+	{
+		Body* b = bodies[i];
+		b->rotationMatrix = Mat22(b->rotation);
+		b->position0 = b->position;
+		b->rotation0 = b->rotation;
+	}
+
+	// Determine overlapping bodies and update contact points.
+	BroadPhase(dt);
+
+	// Integrate forces, solve constraints and integrate velocities, one
+	// island at a time.
+	BuildIslands();
+	SolveIslands(dt);
+
+	// Most iterations any island used, counting a substep as one.
+	iterationsUsed = 0;
+	for (int i = 0; i < (int)islands.size(); ++i)
+	{
+		iterationsUsed = islands[i].iterationsUsed > iterationsUsed ? islands[i].iterationsUsed : iterationsUsed;
+	}
+
+	// Static bodies are not in any island, but may still be moved by
+	// giving them a velocity.
 	for (int i = 0; i < (int)bodies.size(); ++i)
 	{
 		Body* b = bodies[i];
 
+		if (b->invMass > 0.0f)
+			continue;
+
 		b->position += dt * b->velocity;
 		b->rotation += dt * b->angularVelocity;
 
 		b->force.Set(0.0f, 0.0f);
 		b->torque = 0.0f;
 	}
+
+	if (stepSettings.continuousCollision)
+		SolveContinuous();
+}
+
+// Fast bodies can pass through thin bodies between two steps without ever
+// overlapping them. Each fast body is swept from its pose at the start of
+// the step to its new one, against every other body where it ended up,
+// and is moved back to its first impact. The next step's narrowphase then
+// finds the contact. The rest of its motion for this step is lost.
+void World::SolveContinuous()
+{
+	for (int i = 0; i < (int)bodies.size(); ++i)
+	{
+		Body* b = bodies[i];
+
+		if (b->invMass == 0.0f)
+			continue;
+
+		Vec2 dp = b->position - b->position0;
+		float da = b->rotation - b->rotation0;
+		float radius = 0.5f * b->width.Length();
+
+		if (b->bullet == false && dp.Length() + Abs(da) * radius <= continuousDistance)
+			continue;
+
+		float toi = 1.0f;
+		for (int j = 0; j < (int)bodies.size(); ++j)
+		{
+			Body* other = bodies[j];
+			if (other == b || ShouldCollide(b, other) == false)
+				continue;
+
+			// Skip bodies the swept bounding circle can't reach.
+			Vec2 d = other->position - b->position0;
+			float s = Clamp(Dot(d, dp) / Max(Dot(dp, dp), FLT_EPSILON), 0.0f, 1.0f);
+			float reach = radius + 0.5f * other->width.Length();
+			Vec2 gap = d - s * dp;
+			if (Dot(gap, gap) > reach * reach)
+				continue;
+
+			// Sweep each box of a compound, against the children of the
+			// other body near the path.
+			int childCount = b->shape == Body::COMPOUND ? b->compound->count : 1;
+			QueryChildren(&pairChildren2, other, Mat22(other->rotation), b->position0 + 0.5f * dp, radius + 0.5f * dp.Length());
+
+			for (int k = 0; k < childCount; ++k)
+			{
+				for (int l = 0; l < (int)pairChildren2.size(); ++l)
+				{
+					toi = Min(toi, TimeOfImpact(b, k, other, pairChildren2[l]));
+				}
+			}
+		}
+
+		if (toi < 1.0f)
+		{
+			b->position = b->position0 + toi * dp;
+			b->rotation = b->rotation0 + toi * da;
+		}
+	}
 }